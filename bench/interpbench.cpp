@@ -0,0 +1,99 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+
+#include <string.h>
+
+#include "interp.h"
+
+//
+// Microbenchmark for the ramp interpolation kernel. First checks that the
+// scalar and vector paths agree bit for bit, then reports channels per
+// microsecond for each path at a few channel counts.
+//
+// Usage: interpbench [iterations]
+//
+
+using namespace std;
+using namespace std::chrono;
+
+#define MAX_BENCH_CHANNELS 4096
+
+level_t startLevels[MAX_BENCH_CHANNELS];
+level_t deltaLevels[MAX_BENCH_CHANNELS];
+level_t scalarOut[MAX_BENCH_CHANNELS];
+level_t vectorOut[MAX_BENCH_CHANNELS];
+
+typedef void (*interpFunction)(const level_t *, const level_t *, level_t *, unsigned int, int16_t);
+
+// Fill the inputs with random but valid ramps (start and target both in range)
+void randomRamps(unsigned int n) {
+   for ( unsigned int i = 0; i < n; i++ ) {
+      level_t start = rand() % (LEVEL_MAX + 1);
+      level_t target = rand() % (LEVEL_MAX + 1);
+      startLevels[i] = start;
+      deltaLevels[i] = target - start;
+   }
+}
+
+// Compare both paths over every fraction, including the extreme ramps
+bool checkIdentical() {
+   unsigned int n = 1027; // Deliberately not a multiple of the vector width
+
+   randomRamps(n);
+   startLevels[0] = 0;
+   deltaLevels[0] = LEVEL_MAX;
+   startLevels[1] = LEVEL_MAX;
+   deltaLevels[1] = -LEVEL_MAX;
+
+   for ( int fraction = 0; fraction < FRACTION_ONE; fraction++ ) {
+      interpolateScalar(startLevels, deltaLevels, scalarOut, n, fraction);
+      interpolateVector(startLevels, deltaLevels, vectorOut, n, fraction);
+      if ( memcmp(scalarOut, vectorOut, n * sizeof(level_t)) != 0 ) {
+         cout << "MISMATCH at fraction " << fraction << "\n";
+         return false;
+      }
+   }
+   return true;
+}
+
+double channelsPerMicrosecond(interpFunction fn, unsigned int n, unsigned int iterations) {
+   steady_clock::time_point start = steady_clock::now();
+   volatile level_t sink = 0;
+
+   for ( unsigned int i = 0; i < iterations; i++ ) {
+      fn(startLevels, deltaLevels, scalarOut, n, (int16_t)(i & (FRACTION_ONE - 1)));
+      sink = scalarOut[i % n];
+   }
+
+   double us = duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1000.0;
+   (void)sink;
+   return ((double)n * iterations) / us;
+}
+
+int main(int argc, const char* argv[]) {
+   unsigned int counts[] = { 3, 8, 32, 256, 4096 };
+   unsigned long totalChannels = 20000000;
+
+   if ( argc > 1 ) totalChannels = strtoul(argv[1], NULL, 10);
+
+   cout << "Vector path: " << interpolateVectorName() << "\n";
+   if ( !checkIdentical() ) return 1;
+   cout << "Scalar and vector paths are bit-identical\n\n";
+
+   randomRamps(MAX_BENCH_CHANNELS);
+   cout << "channels  scalar ch/us  vector ch/us\n";
+   for ( unsigned int i = 0; i < sizeof(counts) / sizeof(counts[0]); i++ ) {
+      unsigned int n = counts[i];
+      unsigned int iterations = totalChannels / n;
+      double scalar = channelsPerMicrosecond(interpolateScalar, n, iterations);
+      double vector = channelsPerMicrosecond(interpolateVector, n, iterations);
+      cout.width(8);
+      cout << n;
+      cout.width(14);
+      cout << scalar;
+      cout.width(14);
+      cout << vector << "\n";
+   }
+   return 0;
+}
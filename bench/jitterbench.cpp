@@ -0,0 +1,103 @@
+#include <iostream>
+#include <cstdlib>
+#include <string>
+
+#include <string.h>
+#include <pthread.h>
+
+#include "frameclock.h"
+#include "telemetry.h"
+#include "realtime.h"
+
+//
+// Frame jitter benchmark. Waits for frames on the same absolute deadline
+// grid and frame clock as the render thread and reports how late each
+// wakeup was, optionally with the daemon's real-time setup. Run it with
+// and without --rt while something like "stress --cpu 4 --io 2" loads the
+// machine to see what real-time scheduling buys on that board.
+//
+// Usage: jitterbench [--fps=N] [--seconds=N] [--rt[=priority]] [--cpu=N]
+//
+
+using namespace std;
+
+// Value of option name in arg ("--fps=200" gives "200"), "" for a bare
+// flag, NULL if arg is a different option
+const char *optionValue(const char *arg, const char *name) {
+   size_t length = strlen(name);
+
+   if ( strncmp(arg, name, length) != 0 ) return NULL;
+   if ( arg[length] == 0 ) return arg + length;
+   if ( arg[length] == '=' ) return arg + length + 1;
+   return NULL;
+}
+
+int main(int argc, const char* argv[]) {
+   realtimeConfig realtime = { false, DEFAULT_RT_PRIORITY, -1 };
+   unsigned int fps = DEFAULT_FRAME_RATE;
+   unsigned int seconds = 10;
+   FrameClock frameClock;
+   Histogram jitter;
+   unsigned long late = 0;
+   bool locked = false;
+   const char *value;
+   string error;
+
+   for ( int i = 1; i < argc; i++ ) {
+      if ( (value = optionValue(argv[i], "--fps")) != NULL ) {
+         fps = strtoul(value, NULL, 10);
+      } else if ( (value = optionValue(argv[i], "--seconds")) != NULL ) {
+         seconds = strtoul(value, NULL, 10);
+      } else if ( (value = optionValue(argv[i], "--rt")) != NULL ) {
+         realtime.enabled = true;
+         if ( *value != 0 ) realtime.priority = atoi(value);
+      } else if ( (value = optionValue(argv[i], "--cpu")) != NULL ) {
+         realtime.cpu = atoi(value);
+      } else {
+         cout << "Usage: jitterbench [--fps=N] [--seconds=N] [--rt[=priority]] [--cpu=N]\n";
+         return 1;
+      }
+   }
+   if ( (fps < 1) || (fps > 1000) || (seconds < 1) ) {
+      cout << "--fps must be between 1 and 1000 and --seconds at least 1\n";
+      return 1;
+   }
+
+   frameClock.setFrameRate(fps);
+   if ( realtime.enabled ) {
+      locked = lockMemory(error);
+      if ( !locked ) cout << "Warning: " << error << "\n";
+      error.clear();
+   }
+   if ( (realtime.enabled || (realtime.cpu >= 0)) && !enterRealtime(pthread_self(), realtime, error) ) {
+      cout << "Warning: " << error << "\n";
+   }
+   if ( realtime.enabled ) prefaultStack();
+
+   uint64_t origin = FrameClock::now();
+   uint64_t deadline = origin;
+   unsigned long frames = (unsigned long)fps * seconds;
+   for ( unsigned long f = 0; f < frames; f++ ) {
+      deadline = frameClock.nextFrame(origin, deadline);
+      frameClock.waitUntil(deadline, NULL, 0);
+      uint64_t now = FrameClock::now();
+      jitter.record((unsigned long)(now - deadline));
+      if ( now - deadline >= frameClock.framePeriod() ) late++;
+   }
+
+   cout << "fps  frames  p50 us  p99 us  max us  late  realtime\n";
+   cout.width(3);
+   cout << fps;
+   cout.width(8);
+   cout << frames;
+   cout.width(8);
+   cout << jitter.percentile(50);
+   cout.width(8);
+   cout << jitter.percentile(99);
+   cout.width(8);
+   cout << jitter.max();
+   cout.width(6);
+   cout << late;
+   cout << "  " << (error.empty() ? realtimeDescription(realtime, locked) : "failed") << "\n";
+   return 0;
+}
@@ -0,0 +1,118 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "interp.h"
+#include "fixture.h"
+#include "outputwriter.h"
+#include "dutymap.h"
+
+//
+// Microbenchmark for the output side of a frame. Reports nanoseconds per
+// frame for the Pi-Blaster formatter alone, with every channel changing
+// and with nothing changing, and for a whole frame from levels: gamma,
+// quantizing to the output resolution, handing the frame to the backends
+// (just the text one here), formatting and the write(). The writer is
+// given /dev/null, so the kernel's part is as small as it gets.
+//
+// Usage: outputbench [frames]
+//
+
+using namespace std;
+using namespace std::chrono;
+
+// Output steps, Pi-Blaster's default
+#define BENCH_RESOLUTION 1000
+
+struct benchFixture {
+   const char *spec;
+   unsigned int channels;
+};
+
+// The default RGB strip, two RGBW strips and every pin Pi-Blaster drives
+static const benchFixture fixtures[] = {
+   { "rgb:23,24,25", 3 },
+   { "rgbw:4,17,18,22/rgbw:23,24,25,27", 8 },
+   { "rgbw:0,1,2,3/rgbw:4,5,6,7/rgbw:8,9,10,11/rgbw:12,13,14,15/"
+     "rgbw:16,17,18,19/rgbw:20,21,22,23/rgbw:24,25,26,27/rgbw:28,29,30,31", 32 },
+};
+
+// Stage and write frames duties for pins 0 to channels - 1. If changing,
+// every pin gets a new duty every frame.
+double formatNanosPerFrame(int fd, unsigned int channels, unsigned long frames, bool changing) {
+   OutputWriter output;
+   output.setFd(fd);
+
+   steady_clock::time_point start = steady_clock::now();
+   for ( unsigned long f = 0; f < frames; f++ ) {
+      unsigned int duty = changing ? (unsigned int)(f % OUTPUT_DUTY_SCALE) : 5000;
+      for ( unsigned int pin = 0; pin < channels; pin++ ) output.set(pin, duty);
+      output.flush();
+   }
+   return (double)duration_cast<nanoseconds>(steady_clock::now() - start).count() / frames;
+}
+
+// Write frames frames of levels to fixture, every channel on a different
+// output step each frame
+double frameNanosPerFrame(int fd, fixtureTable &fixture, unsigned long frames) {
+   OutputWriter writer;
+   OutputSet output;
+   level_t levels[2][MAX_CHANNELS];
+   writer.setFd(fd);
+   output.add(&writer, "text");
+
+   // Two sets of levels at least one output step apart, alternated
+   for ( unsigned int c = 0; c < fixture.numChannels; c++ ) {
+      levels[0][c] = rand() % (LEVEL_MAX / 2);
+      levels[1][c] = levels[0][c] + (LEVEL_MAX / 4);
+   }
+
+   steady_clock::time_point start = steady_clock::now();
+   for ( unsigned long f = 0; f < frames; f++ ) {
+      writeFrame(fixture, levels[f & 1], BENCH_RESOLUTION, output);
+   }
+   return (double)duration_cast<nanoseconds>(steady_clock::now() - start).count() / frames;
+}
+
+int main(int argc, const char* argv[]) {
+   unsigned long frames = 2000000;
+   int fd;
+
+   if ( argc > 1 ) frames = strtoul(argv[1], NULL, 10);
+   if ( frames == 0 ) frames = 1;
+
+   fd = open("/dev/null", O_WRONLY);
+   if ( fd < 0 ) {
+      cout << "Can't open /dev/null\n";
+      return 1;
+   }
+
+   cout << "channels  format ns/frame  unchanged ns/frame  levels ns/frame\n";
+   for ( unsigned int i = 0; i < sizeof(fixtures) / sizeof(fixtures[0]); i++ ) {
+      fixtureTable fixture;
+      string error;
+
+      if ( !parseFixture(fixtures[i].spec, "cie", fixture, error) || (fixture.numChannels != fixtures[i].channels) ) {
+         cout << "Bad fixture " << fixtures[i].spec << ": " << error << "\n";
+         return 1;
+      }
+
+      double format = formatNanosPerFrame(fd, fixtures[i].channels, frames, true);
+      double unchanged = formatNanosPerFrame(fd, fixtures[i].channels, frames, false);
+      double levels = frameNanosPerFrame(fd, fixture, frames);
+      cout.width(8);
+      cout << fixtures[i].channels;
+      cout.width(17);
+      cout << format;
+      cout.width(20);
+      cout << unchanged;
+      cout.width(17);
+      cout << levels << "\n";
+   }
+   close(fd);
+   return 0;
+}
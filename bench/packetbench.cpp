@@ -0,0 +1,148 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+
+#include <string.h>
+
+#include "pwmcolors.h"
+#include "packet.h"
+#include "replayfilter.h"
+
+//
+// Microbenchmark for the packet parser. Reports packets per microsecond
+// for valid commands and for the traffic the receiver rejects: stray
+// broadcasts without the filter words and truncated packets. The second
+// column is the whole per-packet receive path: parsing, the target ID
+// check, the replay filter and conversion to an engine command.
+//
+// Usage: packetbench [iterations]
+//
+
+using namespace std;
+using namespace std::chrono;
+
+struct benchPacket {
+   const char *name;
+   unsigned char data[PACKET_HEADER_SIZE + 5 + (MAX_TRIPLETS * PACKET_TRIPLET_SIZE)];
+   size_t length;
+   int expected;
+};
+
+size_t setLevelsPacket(unsigned char *out) {
+   size_t length = buildPacketHeader(out, 1, CMD_SETLEVELS, 0);
+   uint32_t ramp = 500;
+
+   memcpy(out + length, &ramp, 4);
+   out[length + 4] = 255;
+   out[length + 5] = 128;
+   out[length + 6] = 0;
+   return length + 7;
+}
+
+size_t patternPacket(unsigned char *out) {
+   size_t length = buildPacketHeader(out, 2, CMD_AUTOPATTERN, 0);
+   uint32_t ramp = 1000;
+
+   memcpy(out + length, &ramp, 4);
+   out[length + 4] = MAX_TRIPLETS;
+   length += 5;
+   for ( unsigned int i = 0; i < MAX_TRIPLETS; i++ ) {
+      uint32_t rest = i * 10;
+      out[length] = rand() & 0xff;
+      out[length + 1] = rand() & 0xff;
+      out[length + 2] = rand() & 0xff;
+      memcpy(out + length + 3, &rest, 4);
+      length += PACKET_TRIPLET_SIZE;
+   }
+   return length;
+}
+
+double packetsPerMicrosecond(const benchPacket &packet, unsigned long iterations, unsigned long &accepted) {
+   steady_clock::time_point start = steady_clock::now();
+   packetCommand cmd;
+   volatile uint32_t sink = 0;
+
+   accepted = 0;
+   for ( unsigned long i = 0; i < iterations; i++ ) {
+      if ( parsePacket(packet.data, packet.length, cmd) == PARSE_OK ) {
+         accepted++;
+         sink = cmd.rampDuration;
+      }
+   }
+
+   double us = duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1000.0;
+   (void)sink;
+   return iterations / us;
+}
+
+double receivedPerMicrosecond(const benchPacket &packet, unsigned long iterations, unsigned long &accepted) {
+   ReplayFilter filter;
+   packetCommand cmd;
+   colorCommand command;
+   volatile uint32_t sink = 0;
+   uint64_t membership = (uint64_t)1 << 2;
+
+   steady_clock::time_point start = steady_clock::now();
+   accepted = 0;
+   for ( unsigned long i = 0; i < iterations; i++ ) {
+      if ( parsePacket(packet.data, packet.length, cmd) != PARSE_OK ) continue;
+      if ( !packetIsForUs(cmd.targets, membership) ) continue;
+
+      // One sender counting its message IDs up, as pwmsend does
+      if ( !filter.accept(0x7f000001, 40000, (uint32_t)i) ) continue;
+      commandFromPacket(cmd, command);
+      accepted++;
+      sink = command.numColors;
+   }
+
+   double us = duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1000.0;
+   (void)sink;
+   return iterations / us;
+}
+
+int main(int argc, const char* argv[]) {
+   benchPacket packets[4];
+   unsigned long iterations = 50000000;
+   unsigned long accepted;
+
+   if ( argc > 1 ) iterations = strtoul(argv[1], NULL, 10);
+
+   packets[0].name = "setlevels";
+   packets[0].length = setLevelsPacket(packets[0].data);
+   packets[0].expected = PARSE_OK;
+
+   packets[1].name = "autopattern";
+   packets[1].length = patternPacket(packets[1].data);
+   packets[1].expected = PARSE_OK;
+
+   // Someone else's broadcast: same size as ours but no filter words
+   packets[2].name = "bad magic";
+   packets[2].length = setLevelsPacket(packets[2].data);
+   packets[2].data[0] ^= 0xff;
+   packets[2].expected = PARSE_BAD_MAGIC;
+
+   // A pattern that claims more triplets than it carries
+   packets[3].name = "truncated";
+   packets[3].length = patternPacket(packets[3].data) - 1;
+   packets[3].expected = PARSE_TRUNCATED;
+
+   cout << "packet        bytes  packets/us  received/us\n";
+   for ( unsigned int i = 0; i < sizeof(packets) / sizeof(packets[0]); i++ ) {
+      packetCommand cmd;
+      if ( parsePacket(packets[i].data, packets[i].length, cmd) != packets[i].expected ) {
+         cout << "UNEXPECTED result for " << packets[i].name << "\n";
+         return 1;
+      }
+      double rate = packetsPerMicrosecond(packets[i], iterations, accepted);
+      cout.width(12);
+      cout << left << packets[i].name << right;
+      cout.width(7);
+      cout << packets[i].length;
+      cout.width(12);
+      cout << rate;
+      rate = receivedPerMicrosecond(packets[i], iterations, accepted);
+      cout.width(13);
+      cout << rate << "\n";
+   }
+   return 0;
+}
@@ -0,0 +1,506 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <cctype>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "pwmcolors.h"
+#include "packet.h"
+#include "interp.h"
+
+//
+// End to end benchmark of the daemon. It starts pwmcolors writing to a
+// FIFO in place of /dev/pi-blaster, replays UDP commands to it over
+// loopback and timestamps every line it writes, then prints one JSON
+// object with:
+//
+//    latency    microseconds from sending a CMD_SETLEVELS without a ramp
+//               to the line that shows it (p50, p90, p99, max) and the
+//               commands that never showed up
+//    ramps      how far each timed ramp finished from its requested
+//               duration, in microseconds, measured from sending it (so
+//               including the latency)
+//    cpu        user + system microseconds the daemon used per 1000
+//               commands
+//    telemetry  the daemon's own CMD_QUERY snapshot at the end
+//
+// Usage: replaybench [options] [daemon [daemon options ...]]
+//
+//    --rate=N         Commands per second. Defaults to 500.
+//    --count=N        Commands to time. Defaults to 2000.
+//    --ramps=MS,...   Ramps to time, each up and then down. Defaults to
+//                     100,250,500,1000; "none" skips them.
+//    --trace=FILE     Replay a recorded trace instead of the synthetic
+//                     commands. Each line is the millisecond to send at
+//                     and the datagram in hex; lines starting with # are
+//                     skipped. Level commands in it are timed like the
+//                     synthetic ones.
+//    --port=N         Port to run the daemon on. Defaults to 6566.
+//
+// The daemon defaults to the pwmcolors next to this program. It is run
+// with a linear curve and 10000 steps so every level shows up as its own
+// line, and anything after its path is passed on, e.g. --eventloop.
+//
+
+using namespace std;
+
+// The fixture's red pin and the settings the daemon is run with
+#define BENCH_PIN        23
+#define BENCH_RESOLUTION 10000
+
+// Longest a command may take to show up before it counts as dropped
+#define BENCH_TIMEOUT 1000000
+
+// Time to let the daemon settle between phases, microseconds
+#define BENCH_SETTLE 150000
+
+// One line written by the daemon and when it was read
+struct outputLine {
+   uint64_t time;
+   unsigned int pin;
+   unsigned int duty; // Out of BENCH_RESOLUTION
+};
+
+// A command sent whose output we look for
+struct timedCommand {
+   uint64_t sentAt;
+   unsigned int duty;      // Red duty it ends on
+   uint64_t rampDuration;  // Microseconds, 0 for an immediate change
+};
+
+uint64_t nowMicros() {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+void sleepUntil(uint64_t due) {
+   struct timespec wake;
+   wake.tv_sec = due / 1000000;
+   wake.tv_nsec = (due % 1000000) * 1000;
+   clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+}
+
+string getOption(const string &name, int &argc, const char* argv[], bool &found) {
+   found = false;
+   for ( int i = 1; i < argc; i++ ) {
+      string arg = argv[i];
+      if ( arg.compare(0, name.length(), name) != 0 ) continue;
+      if ( (arg.length() > name.length()) && (arg[name.length()] != '=') ) continue;
+      found = true;
+      for ( int j = i; j < argc - 1; j++ ) argv[j] = argv[j + 1];
+      argc--;
+      return (arg.length() > name.length()) ? arg.substr(name.length() + 1) : "";
+   }
+   return "";
+}
+
+// The duty the daemon writes for an 8 bit level with a linear curve
+unsigned int expectedDuty(uint8_t level) {
+   unsigned int q15 = levelFromDouble(level / 255.0);
+   return ((q15 * BENCH_RESOLUTION) + (LEVEL_MAX / 2)) / LEVEL_MAX;
+}
+
+// Reads the FIFO until told to stop, timestamping each complete line
+class OutputRecorder {
+public:
+   OutputRecorder(int fd) : fd(fd), stopping(false) {}
+
+   void run() {
+      char buf[4096];
+      string partial;
+
+      while ( !stopping ) {
+         ssize_t length = read(fd, buf, sizeof(buf));
+         uint64_t now = nowMicros();
+         if ( length <= 0 ) {
+            if ( (length < 0) && (errno == EINTR) ) continue;
+            break;
+         }
+         partial.append(buf, length);
+         size_t start = 0;
+         size_t end;
+         while ( (end = partial.find('\n', start)) != string::npos ) {
+            outputLine line;
+            unsigned int pin;
+            double value;
+            if ( sscanf(partial.c_str() + start, "%u=%lf", &pin, &value) == 2 ) {
+               line.time = now;
+               line.pin = pin;
+               line.duty = (unsigned int)((value * BENCH_RESOLUTION) + 0.5);
+               lines.push_back(line);
+            }
+            start = end + 1;
+         }
+         partial.erase(0, start);
+      }
+   }
+
+   void stop() { stopping = true; }
+
+   vector<outputLine> lines;
+
+private:
+   int fd;
+   volatile bool stopping;
+};
+
+// Send one datagram to the daemon
+void sendPacket(int sock, const struct sockaddr_in &to, const vector<unsigned char> &packet) {
+   sendto(sock, &packet[0], packet.size(), 0, (const struct sockaddr *)&to, sizeof(to));
+}
+
+vector<unsigned char> setLevelsPacket(uint32_t messageID, uint8_t red, uint32_t rampMs) {
+   vector<unsigned char> packet(PACKET_HEADER_SIZE + 7);
+   buildPacketHeader(&packet[0], messageID, CMD_SETLEVELS, 0);
+   memcpy(&packet[PACKET_HEADER_SIZE], &rampMs, 4);
+   packet[PACKET_HEADER_SIZE + 4] = red;
+   packet[PACKET_HEADER_SIZE + 5] = 0;
+   packet[PACKET_HEADER_SIZE + 6] = 0;
+   return packet;
+}
+
+// Send CMD_QUERY and wait up to timeout microseconds for the answer
+string queryDaemon(int sock, const struct sockaddr_in &to, uint32_t messageID, uint64_t timeout) {
+   vector<unsigned char> packet(PACKET_HEADER_SIZE);
+   char reply[4097];
+   struct pollfd pfd;
+
+   buildPacketHeader(&packet[0], messageID, CMD_QUERY, 0);
+   sendPacket(sock, to, packet);
+   pfd.fd = sock;
+   pfd.events = POLLIN;
+   if ( poll(&pfd, 1, (int)(timeout / 1000)) <= 0 ) return "";
+   ssize_t length = recv(sock, reply, sizeof(reply) - 1, 0);
+   if ( length <= 0 ) return "";
+   while ( (length > 0) && (reply[length - 1] == '\n') ) length--;
+   reply[length] = 0;
+   return reply;
+}
+
+// Read a trace of "ms hex" lines. Returns false with a message in error if
+// the file can't be read.
+bool readTrace(const string &path, vector<uint64_t> &times, vector< vector<unsigned char> > &packets, string &error) {
+   FILE *file = fopen(path.c_str(), "r");
+   char line[8192];
+
+   if ( file == NULL ) {
+      error = "unable to open " + path;
+      return false;
+   }
+   while ( fgets(line, sizeof(line), file) != NULL ) {
+      char *p = line;
+      char *end;
+      vector<unsigned char> packet;
+
+      if ( (line[0] == '#') || (line[0] == '\n') ) continue;
+      unsigned long long ms = strtoull(p, &end, 10);
+      if ( end == p ) continue;
+      p = end;
+      while ( *p == ' ' ) p++;
+      while ( isxdigit((unsigned char)p[0]) && isxdigit((unsigned char)p[1]) ) {
+         char hex[3] = { p[0], p[1], 0 };
+         packet.push_back((unsigned char)strtoul(hex, NULL, 16));
+         p += 2;
+      }
+      if ( packet.empty() ) continue;
+      times.push_back(ms * 1000);
+      packets.push_back(packet);
+   }
+   fclose(file);
+   return true;
+}
+
+// The pth percentile of sorted values
+uint64_t percentile(const vector<uint64_t> &sorted, unsigned int p) {
+   if ( sorted.empty() ) return 0;
+   size_t rank = (sorted.size() * p + 99) / 100;
+   if ( rank == 0 ) rank = 1;
+   return sorted[rank - 1];
+}
+
+// The first line on the red pin at or after time showing duty, before
+// limit. Returns NULL if there is none.
+const outputLine *findLine(const vector<outputLine> &lines, uint64_t time, unsigned int duty, uint64_t limit) {
+   size_t low = 0;
+   size_t high = lines.size();
+
+   while ( low < high ) {
+      size_t mid = (low + high) / 2;
+      if ( lines[mid].time < time ) low = mid + 1; else high = mid;
+   }
+   for ( size_t i = low; (i < lines.size()) && (lines[i].time < limit); i++ ) {
+      if ( (lines[i].pin == BENCH_PIN) && (lines[i].duty == duty) ) return &lines[i];
+   }
+   return NULL;
+}
+
+int main(int argc, const char* argv[]) {
+   bool found;
+   string value;
+   string error;
+
+   value = getOption("--rate", argc, argv, found);
+   unsigned int rate = found ? strtoul(value.c_str(), NULL, 10) : 500;
+   value = getOption("--count", argc, argv, found);
+   unsigned int count = found ? strtoul(value.c_str(), NULL, 10) : 2000;
+   value = getOption("--ramps", argc, argv, found);
+   string ramps = found ? value : "100,250,500,1000";
+   string tracePath = getOption("--trace", argc, argv, found);
+   bool trace = found;
+   value = getOption("--port", argc, argv, found);
+   unsigned int port = found ? strtoul(value.c_str(), NULL, 10) : 6566;
+   if ( (rate < 1) || (rate > 100000) ) {
+      cerr << "ERROR: --rate must be between 1 and 100000\n";
+      return 1;
+   }
+
+   // The daemon next to us unless told otherwise
+   string daemon;
+   if ( argc >= 2 ) {
+      daemon = argv[1];
+   } else {
+      char self[4096];
+      ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+      self[(length > 0) ? length : 0] = 0;
+      daemon = self;
+      size_t slash = daemon.rfind('/');
+      daemon = ((slash == string::npos) ? string(".") : daemon.substr(0, slash)) + "/pwmcolors";
+   }
+
+   vector<uint64_t> traceTimes;
+   vector< vector<unsigned char> > tracePackets;
+   if ( trace && !readTrace(tracePath, traceTimes, tracePackets, error) ) {
+      cerr << "ERROR: " << error << "\n";
+      return 1;
+   }
+
+   // The FIFO stands in for /dev/pi-blaster. We hold a write end open
+   // ourselves so reads block rather than see end of file before the
+   // daemon opens it and after it is gone.
+   char dir[] = "/tmp/replaybench.XXXXXX";
+   if ( mkdtemp(dir) == NULL ) {
+      perror("mkdtemp");
+      return 1;
+   }
+   string fifo = string(dir) + "/pi-blaster";
+   if ( mkfifo(fifo.c_str(), 0600) < 0 ) {
+      perror("mkfifo");
+      return 1;
+   }
+   int readFd = open(fifo.c_str(), O_RDONLY | O_NONBLOCK);
+   int holdFd = open(fifo.c_str(), O_WRONLY);
+   fcntl(readFd, F_SETFL, fcntl(readFd, F_GETFL) & ~O_NONBLOCK);
+   OutputRecorder recorder(readFd);
+   thread recorderThread(&OutputRecorder::run, &recorder);
+
+   string portOption = "--port=" + to_string(port);
+   string deviceOption = "--device=" + fifo;
+   string resolutionOption = "--resolution=" + to_string(BENCH_RESOLUTION);
+   vector<const char *> args;
+   args.push_back(daemon.c_str());
+   args.push_back("--daemon");
+   args.push_back("--state=off");
+   args.push_back("--multicast=off");
+   args.push_back("--gamma=linear");
+   args.push_back(resolutionOption.c_str());
+   args.push_back(portOption.c_str());
+   args.push_back(deviceOption.c_str());
+   for ( int i = 2; i < argc; i++ ) args.push_back(argv[i]);
+   args.push_back(NULL);
+
+   pid_t pid = fork();
+   if ( pid == 0 ) {
+      int null = open("/dev/null", O_RDWR);
+      dup2(null, 0);
+      dup2(null, 1);
+      dup2(null, 2);
+      close(readFd);
+      close(holdFd);
+      execv(daemon.c_str(), (char * const *)&args[0]);
+      _exit(127);
+   }
+
+   // Queries go from a socket of their own, so the daemon's duplicate
+   // filter tracks their message IDs apart from a trace's
+   int sock = socket(AF_INET, SOCK_DGRAM, 0);
+   int querySock = socket(AF_INET, SOCK_DGRAM, 0);
+   struct sockaddr_in to;
+   memset(&to, 0, sizeof(to));
+   to.sin_family = AF_INET;
+   to.sin_port = htons(port);
+   to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   uint32_t messageID = 1;
+
+   // The daemon is up once it answers a query
+   uint64_t giveUp = nowMicros() + 5000000;
+   string telemetry;
+   while ( telemetry.empty() && (nowMicros() < giveUp) ) {
+      telemetry = queryDaemon(querySock, to, messageID++, 50000);
+   }
+   if ( telemetry.empty() ) {
+      cerr << "ERROR: " << daemon << " didn't answer on port " << port << "\n";
+      kill(pid, SIGKILL);
+      waitpid(pid, NULL, 0);
+      recorder.stop();
+      close(holdFd);
+      recorderThread.join();
+      unlink(fifo.c_str());
+      rmdir(dir);
+      return 1;
+   }
+
+   vector<timedCommand> immediate;
+   vector<timedCommand> timedRamps;
+   unsigned long sent = 0;
+   uint64_t period = 1000000 / rate;
+   uint64_t start = nowMicros() + 10000;
+
+   if ( trace ) {
+      // Replay as recorded, timing the level commands that change red
+      int lastRed = -1;
+      for ( size_t i = 0; i < tracePackets.size(); i++ ) {
+         packetCommand cmd;
+         sleepUntil(start + traceTimes[i]);
+         uint64_t sentAt = nowMicros();
+         sendPacket(sock, to, tracePackets[i]);
+         sent++;
+         if ( parsePacket(&tracePackets[i][0], tracePackets[i].size(), cmd) != PARSE_OK ) continue;
+         if ( (cmd.command != CMD_SETLEVELS) || (cmd.executeAt != 0) ) continue;
+         if ( (cmd.rampDuration == 0) && (cmd.red == lastRed) ) continue;
+         timedCommand timed = { sentAt, expectedDuty(cmd.red), (uint64_t)cmd.rampDuration * 1000 };
+         if ( cmd.rampDuration == 0 ) immediate.push_back(timed); else timedRamps.push_back(timed);
+         lastRed = cmd.red;
+      }
+   } else {
+      // Every command changes red, cycling through 1 - 255 so the line
+      // showing each one can be told apart from its neighbours
+      for ( unsigned int k = 0; k < count; k++ ) {
+         uint8_t red = 1 + (k % 255);
+         vector<unsigned char> packet = setLevelsPacket(messageID++, red, 0);
+         sleepUntil(start + k * period);
+         timedCommand timed = { nowMicros(), expectedDuty(red), 0 };
+         sendPacket(sock, to, packet);
+         immediate.push_back(timed);
+         sent++;
+      }
+
+      // Ramps from off to full and back, each with time to finish
+      sleepUntil(nowMicros() + BENCH_SETTLE);
+      sendPacket(sock, to, setLevelsPacket(messageID++, 0, 0));
+      sent++;
+      sleepUntil(nowMicros() + BENCH_SETTLE);
+      size_t pos = 0;
+      while ( (ramps != "none") && (pos < ramps.size()) ) {
+         unsigned int ms = strtoul(ramps.c_str() + pos, NULL, 10);
+         for ( unsigned int direction = 0; direction < 2; direction++ ) {
+            uint8_t red = (direction == 0) ? 255 : 0;
+            vector<unsigned char> packet = setLevelsPacket(messageID++, red, ms);
+            timedCommand timed = { nowMicros(), expectedDuty(red), (uint64_t)ms * 1000 };
+            sendPacket(sock, to, packet);
+            timedRamps.push_back(timed);
+            sent++;
+            sleepUntil(timed.sentAt + timed.rampDuration + BENCH_SETTLE);
+         }
+         pos = ramps.find(',', pos);
+         if ( pos == string::npos ) break;
+         pos++;
+      }
+   }
+   sleepUntil(nowMicros() + BENCH_SETTLE);
+   telemetry = queryDaemon(querySock, to, messageID++, 500000);
+
+   // Stop the daemon and collect its CPU time
+   struct rusage usage;
+   int status;
+   kill(pid, SIGTERM);
+   wait4(pid, &status, 0, &usage);
+   recorder.stop();
+   close(holdFd);
+   recorderThread.join();
+   close(readFd);
+   close(sock);
+   close(querySock);
+   unlink(fifo.c_str());
+   rmdir(dir);
+
+   const vector<outputLine> &lines = recorder.lines;
+
+   // An immediate command is matched to the first line showing its level
+   // before the next command with the same level was sent
+   vector<uint64_t> latencies;
+   unsigned long dropped = 0;
+   for ( size_t k = 0; k < immediate.size(); k++ ) {
+      uint64_t limit = immediate[k].sentAt + BENCH_TIMEOUT;
+      for ( size_t j = k + 1; j < immediate.size(); j++ ) {
+         if ( immediate[j].duty == immediate[k].duty ) {
+            if ( immediate[j].sentAt < limit ) limit = immediate[j].sentAt;
+            break;
+         }
+      }
+      const outputLine *line = findLine(lines, immediate[k].sentAt, immediate[k].duty, limit);
+      if ( line == NULL ) {
+         dropped++;
+      } else {
+         latencies.push_back(line->time - immediate[k].sentAt);
+      }
+   }
+   sort(latencies.begin(), latencies.end());
+
+   // A ramp is done when its target shows up
+   string rampJSON;
+   uint64_t worstRamp = 0;
+   unsigned long rampsMissed = 0;
+   for ( size_t i = 0; i < timedRamps.size(); i++ ) {
+      const timedCommand &ramp = timedRamps[i];
+      const outputLine *line = findLine(lines, ramp.sentAt, ramp.duty, ramp.sentAt + ramp.rampDuration + BENCH_TIMEOUT);
+      if ( !rampJSON.empty() ) rampJSON += ",";
+      rampJSON += "{\"duration\":" + to_string(ramp.rampDuration);
+      if ( line == NULL ) {
+         rampsMissed++;
+         rampJSON += ",\"error\":null}";
+         continue;
+      }
+      int64_t rampError = (int64_t)(line->time - ramp.sentAt) - (int64_t)ramp.rampDuration;
+      uint64_t magnitude = (rampError < 0) ? -rampError : rampError;
+      if ( magnitude > worstRamp ) worstRamp = magnitude;
+      rampJSON += ",\"error\":" + to_string(rampError) + "}";
+   }
+
+   uint64_t cpu = ((uint64_t)usage.ru_utime.tv_sec * 1000000) + usage.ru_utime.tv_usec +
+                  ((uint64_t)usage.ru_stime.tv_sec * 1000000) + usage.ru_stime.tv_usec;
+
+   string daemonArgs;
+   for ( size_t i = 1; i + 1 < args.size(); i++ ) {
+      if ( !daemonArgs.empty() ) daemonArgs += " ";
+      daemonArgs += args[i];
+   }
+
+   cout << "{\"daemon\":\"" << daemon << "\",\"args\":\"" << daemonArgs << "\"";
+   cout << ",\"rate\":" << (trace ? 0 : rate) << ",\"commands\":" << sent << ",\"lines\":" << lines.size();
+   cout << ",\"latency\":{\"samples\":" << latencies.size() << ",\"dropped\":" << dropped;
+   cout << ",\"p50\":" << percentile(latencies, 50) << ",\"p90\":" << percentile(latencies, 90);
+   cout << ",\"p99\":" << percentile(latencies, 99) << ",\"max\":" << (latencies.empty() ? 0 : latencies.back()) << "}";
+   cout << ",\"ramps\":[" << rampJSON << "],\"rampWorst\":" << worstRamp << ",\"rampsMissed\":" << rampsMissed;
+   cout << ",\"cpu\":{\"total\":" << cpu << ",\"per1000\":" << (sent ? (cpu * 1000) / sent : 0) << "}";
+   cout << ",\"telemetry\":" << (telemetry.empty() ? "null" : telemetry) << "}\n";
+   return 0;
+}
@@ -0,0 +1,63 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pwmcolors.h"
+#include "packet.h"
+#include "patternupload.h"
+#include "replayfilter.h"
+
+//
+// Fuzz target for the packet parser. Built against libFuzzer when the
+// compiler supports -fsanitize=fuzzer; otherwise packetfuzzdriver.cpp
+// provides a main() which feeds it mutated packets or files.
+//
+// Every accepted packet goes through the rest of the receive path (the
+// target ID check, the replay filter and conversion to an engine command)
+// and has all of its triplets read. Pattern chunks are decoded on their own
+// and then fed to one long lived PatternUpload, as the receive thread does,
+// so reassembly across inputs is covered too. The sanitizers see any access
+// past the end of the datagram or the step buffers.
+//
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+   packetCommand cmd;
+   volatile unsigned int sum = 0;
+
+   static ReplayFilter filter;
+   static PatternUpload upload;
+   colorCommand command;
+
+   if ( parsePacket(data, size, cmd) != PARSE_OK ) return 0;
+
+   // The sender is taken from the message ID so the filter's table fills
+   // up and evicts as it would with many controllers
+   filter.accept(cmd.messageID & 0xff, 6565, cmd.messageID);
+   sum = sum + packetIsForUs(cmd.targets, 0x5);
+   commandFromPacket(cmd, command);
+   sum = sum + command.numColors + command.effect.numColors;
+
+   for ( unsigned int i = 0; i < cmd.numColors; i++ ) {
+      uint8_t red, green, blue;
+      uint32_t rest;
+      cmd.tripletAt(i, red, green, blue, rest);
+      sum = sum + red + green + blue + rest;
+   }
+
+   if ( cmd.command == CMD_PATTERNCHUNK ) {
+      static patternStep steps[PATTERN_MAX_STEPS];
+      unsigned int room = (cmd.chunkOffset < PATTERN_MAX_STEPS) ? PATTERN_MAX_STEPS - cmd.chunkOffset : 0;
+      decodeChunkSteps(cmd.chunkData, cmd.chunkLength, cmd.chunkEncoding, steps, room);
+
+      // A finished upload is read back and released, as the engine would
+      int buffer = upload.addChunk(cmd);
+      if ( buffer >= 0 ) {
+         const patternStep *finished = upload.steps(buffer);
+         sum = sum + upload.patternID(buffer) + upload.rampDuration(buffer);
+         for ( unsigned int i = 0; i < upload.numSteps(buffer); i++ ) {
+            sum = sum + finished[i].red + finished[i].green + finished[i].blue + finished[i].restDuration;
+         }
+         upload.release(buffer);
+      }
+   }
+   return 0;
+}
@@ -0,0 +1,91 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cstdlib>
+
+#include <stdint.h>
+#include <string.h>
+
+#include "pwmcolors.h"
+#include "packet.h"
+
+//
+// Standalone driver for the packet fuzz target, for compilers without
+// libFuzzer. With file arguments each file is run once as an input.
+// Without, random packets are generated: mostly valid headers with random
+// commands, lengths and bodies so the parser's length checks get exercised
+// rather than just the magic filter. Most pattern chunks are made part of a
+// few small uploads so reassembly gets to finish some of them.
+//
+// Usage: packetfuzz [files...]
+//        packetfuzz --iterations=N [--seed=N]
+//
+
+using namespace std;
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int runFile(const char *path) {
+   ifstream in(path, ios::binary);
+   if ( !in ) {
+      cout << "Unable to open " << path << "\n";
+      return 1;
+   }
+   vector<char> bytes((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+   // Copy into an exactly sized heap buffer so overreads hit the redzone
+   uint8_t *data = new uint8_t[bytes.size()];
+   if ( !bytes.empty() ) memcpy(data, &bytes[0], bytes.size());
+   LLVMFuzzerTestOneInput(data, bytes.size());
+   delete[] data;
+   return 0;
+}
+
+int main(int argc, const char* argv[]) {
+   unsigned long iterations = 1000000;
+   unsigned int seed = 1;
+   bool files = false;
+   size_t maxLength = PACKET_HEADER_SIZE + 5 + (MAX_TRIPLETS * PACKET_TRIPLET_SIZE) + 16;
+
+   for ( int i = 1; i < argc; i++ ) {
+      if ( strncmp(argv[i], "--iterations=", 13) == 0 ) {
+         iterations = strtoul(argv[i] + 13, NULL, 10);
+      } else if ( strncmp(argv[i], "--seed=", 7) == 0 ) {
+         seed = strtoul(argv[i] + 7, NULL, 10);
+      } else {
+         files = true;
+         if ( runFile(argv[i]) != 0 ) return 1;
+      }
+   }
+   if ( files ) return 0;
+
+   srand(seed);
+   for ( unsigned long n = 0; n < iterations; n++ ) {
+      size_t length = rand() % (maxLength + 1);
+      uint8_t *data = new uint8_t[length];
+
+      for ( size_t i = 0; i < length; i++ ) data[i] = rand() & 0xff;
+
+      // Most inputs get a real header so they reach the command parsing
+      if ( (rand() % 8) != 0 && length >= PACKET_HEADER_SIZE ) {
+         buildPacketHeader(data, n, rand() % 13, 0);
+         if ( length > PACKET_HEADER_SIZE + 4 ) data[PACKET_HEADER_SIZE + 4] = rand() % (MAX_TRIPLETS + 4);
+
+         if ( (data[12] == CMD_PATTERNCHUNK) && (length >= PACKET_HEADER_SIZE + PACKET_CHUNK_HEADER_SIZE) && ((rand() % 4) != 0) ) {
+            uint8_t *body = data + PACKET_HEADER_SIZE;
+            uint16_t sequence = rand() % 2;
+            uint16_t total = 1 + (rand() % 8);
+            uint16_t offset = rand() % total;
+            body[0] = rand() % 2;
+            memcpy(body + 1, &sequence, 2);
+            memcpy(body + 3, &offset, 2);
+            memcpy(body + 5, &total, 2);
+            body[11] = rand() % 2;
+         }
+      }
+
+      LLVMFuzzerTestOneInput(data, length);
+      delete[] data;
+   }
+   cout << "Ran " << iterations << " inputs\n";
+   return 0;
+}
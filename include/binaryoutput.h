@@ -0,0 +1,57 @@
+#ifndef BINARYOUTPUT_H
+#define BINARYOUTPUT_H
+
+#include <atomic>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "outputbackend.h"
+
+// Identifies a binary frame record: "PMCF"
+#define BINARY_FRAME_MAGIC 0x46434d50
+
+// Magic, Sequence, Time and NumPins before the pins
+#define BINARY_FRAME_HEADER 17
+
+// Bytes per pin: Pin and Duty
+#define BINARY_FRAME_PIN 3
+
+// Longest record, well under PIPE_BUF so a FIFO never splits one
+#define BINARY_FRAME_MAX (BINARY_FRAME_HEADER + (OUTPUT_MAX_PINS * BINARY_FRAME_PIN))
+
+// Encode frame as a record into out (which must hold BINARY_FRAME_MAX
+// bytes) and return its length. All values are little endian: Magic u32,
+// Sequence u32, Time u64 (monotonic microseconds), NumPins u8, then Pin u8
+// and Duty u16 (out of OUTPUT_DUTY_SCALE) for each pin.
+size_t encodeBinaryFrame(const outputFrame &frame, unsigned char *out);
+
+// Decode the record at the start of the length bytes at data. Returns its
+// length, or 0 if there isn't a whole valid record there.
+size_t decodeBinaryFrame(const unsigned char *data, size_t length, outputFrame &frame);
+
+// Writes each changed frame as one binary record, in a single write(), to
+// a file, FIFO or anything else with a file descriptor. A reader gets
+// whole frames with no text to parse. If the descriptor can't take a
+// record it is dropped and the next frame is sent even if nothing changed,
+// unless the write failed for good (e.g. EPIPE once the reader is gone).
+class BinaryOutput : public OutputBackend {
+public:
+   explicit BinaryOutput(int fd);
+
+   bool write(const outputFrame &frame);
+   bool pending() const { return resend; }
+
+   unsigned long framesWritten() const { return framesCount.load(std::memory_order_relaxed); }
+   unsigned long framesDropped() const { return droppedCount.load(std::memory_order_relaxed); }
+
+private:
+   int fd;
+   bool resend;
+   unsigned char buf[BINARY_FRAME_MAX];
+
+   std::atomic<unsigned long> framesCount;
+   std::atomic<unsigned long> droppedCount;
+};
+
+#endif
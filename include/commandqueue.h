@@ -0,0 +1,78 @@
+#ifndef COMMANDQUEUE_H
+#define COMMANDQUEUE_H
+
+#include <atomic>
+
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+// Bounded single-producer/single-consumer ring buffer.
+//
+// Exactly one thread may call push() and exactly one (other) thread may
+// call pop(). The consumer can block on notifyFd() (an eventfd) which
+// becomes readable whenever the producer has added an item, so the
+// consumer never has to spin or poll on a timer to notice new work.
+// SIZE must be a power of two.
+template <typename T, unsigned int SIZE>
+class CommandQueue {
+public:
+   CommandQueue() : head(0), tail(0), droppedCount(0) {
+      static_assert((SIZE & (SIZE - 1)) == 0, "CommandQueue SIZE must be a power of two");
+      eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   }
+
+   ~CommandQueue() {
+      if ( eventFd >= 0 ) close(eventFd);
+   }
+
+   // Producer side. Returns false (and counts a drop) if the queue is full.
+   bool push(const T &item) {
+      unsigned int h = head.load(std::memory_order_relaxed);
+      if ( h - tail.load(std::memory_order_acquire) >= SIZE ) {
+         droppedCount.fetch_add(1, std::memory_order_relaxed);
+         return false;
+      }
+      items[h & (SIZE - 1)] = item;
+      head.store(h + 1, std::memory_order_release);
+
+      uint64_t one = 1;
+      ssize_t res = write(eventFd, &one, sizeof(one));
+      (void)res;
+      return true;
+   }
+
+   // Consumer side. Returns false if there is nothing to pop.
+   bool pop(T &item) {
+      unsigned int t = tail.load(std::memory_order_relaxed);
+      if ( t == head.load(std::memory_order_acquire) ) return false;
+      item = items[t & (SIZE - 1)];
+      tail.store(t + 1, std::memory_order_release);
+      return true;
+   }
+
+   // Safe to call from any thread
+   bool empty() const {
+      return tail.load(std::memory_order_acquire) == head.load(std::memory_order_acquire);
+   }
+
+   // Consumer side. Reset the eventfd counter. Call this *before* draining
+   // the queue so a push racing with the drain re-arms the descriptor.
+   void clearNotify() {
+      uint64_t count;
+      ssize_t res = read(eventFd, &count, sizeof(count));
+      (void)res;
+   }
+
+   int notifyFd() const { return eventFd; }
+   unsigned int dropped() const { return droppedCount.load(std::memory_order_relaxed); }
+
+private:
+   std::atomic<unsigned int> head;
+   std::atomic<unsigned int> tail;
+   std::atomic<unsigned int> droppedCount;
+   int eventFd;
+   T items[SIZE];
+};
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef DUTYMAP_H
+#define DUTYMAP_H
+
+#include "interp.h"
+#include "gamma.h"
+#include "fixture.h"
+#include "outputbackend.h"
+
+// Mapping from the engine's perceptual Q15 levels to what is written to
+// the device: the channel's gamma curve, then one of resolution steps the
+// PWM output can actually produce, then an integer duty for the writer.
+// Levels the device can't tell apart map to the same duty, so they aren't
+// written twice.
+
+// Quantize a Q15 duty to one of resolution steps
+inline unsigned int quantizeDuty(level_t duty, unsigned int resolution) {
+   return (((unsigned int)duty * resolution) + (LEVEL_MAX / 2)) / LEVEL_MAX;
+}
+
+// The output step a channel with curve shows for level
+inline unsigned int outputStep(const gammaCurve *curve, level_t level, unsigned int resolution) {
+   return quantizeDuty(gammaApply(curve, level), resolution);
+}
+
+// A level as the writer's integer duty out of OUTPUT_DUTY_SCALE
+inline unsigned int levelToDuty(const gammaCurve *curve, level_t level, unsigned int resolution) {
+   return (outputStep(curve, level, resolution) * OUTPUT_DUTY_SCALE) / resolution;
+}
+
+// The lowest level above level, and the highest below it, at which a
+// channel shows a different output step. On the top and bottom steps that
+// is full on and off.
+level_t levelStepUp(const gammaCurve *curve, level_t level, unsigned int resolution);
+level_t levelStepDown(const gammaCurve *curve, level_t level, unsigned int resolution);
+
+// Write one frame with a level for every channel of fixture, which is
+// updated to show them, to every backend of output. Returns false if any
+// of them dropped the frame.
+bool writeFrame(fixtureTable &fixture, const level_t *levels, unsigned int resolution, OutputSet &output);
+
+#endif
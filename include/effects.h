@@ -0,0 +1,58 @@
+#ifndef EFFECTS_H
+#define EFFECTS_H
+
+#include <stdint.h>
+
+// Effect types for CMD_EFFECT
+#define EFFECT_BREATHE 0 // Fade each palette color in and out, one per period
+#define EFFECT_RAINBOW 1 // Rotate through the palette, or every hue, once per period
+#define EFFECT_FLICKER 2 // Wander randomly between palette colors every period
+#define EFFECT_STROBE  3 // Flash each palette color in turn, once per period
+#define NUM_EFFECTS    4
+
+// Most palette colors an effect can have
+#define EFFECT_MAX_COLORS 8
+
+// Shortest effect period in milliseconds
+#define EFFECT_MIN_PERIOD 10
+
+// Share of a strobe period the flash is on for, in percent
+#define STROBE_DUTY 20
+
+// An effect and its parameters. Everything an effect shows is worked out
+// from these and the time since it started, so nodes given the same
+// parameters and start time show exactly the same thing.
+struct effectParams {
+   uint8_t type;
+   uint32_t period;  // Milliseconds
+   uint32_t seed;    // For the random effects
+   uint8_t numColors;
+   uint8_t colors[EFFECT_MAX_COLORS][3];
+};
+
+// True if effect can be played. An empty palette is allowed; each effect
+// then uses its own default.
+bool effectValid(const effectParams &effect);
+
+// The color effect shows elapsed microseconds after it started, each
+// channel between 0.0 and 1.0
+void effectColor(const effectParams &effect, uint64_t elapsed, double &red, double &green, double &blue);
+
+// The first time after elapsed at which the color can change, or 0 if it
+// changes continuously and should be rendered every frame
+uint64_t effectNextChange(const effectParams &effect, uint64_t elapsed);
+
+// Name of an effect type for display and parsing, NULL if there is none
+const char *effectName(unsigned int type);
+
+// A well mixed 32 bit hash of seed and n. The random effects draw from
+// this rather than a stateful generator, so their output depends only on
+// the seed and the time.
+uint32_t effectHash(uint32_t seed, uint32_t n);
+
+// Fast xorshift generator with a separate state per thread, seeded from
+// the clock and the thread the first time it is used. For randomness that
+// doesn't have to match between nodes.
+uint32_t fastRandom();
+
+#endif
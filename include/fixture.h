@@ -0,0 +1,58 @@
+#ifndef FIXTURE_H
+#define FIXTURE_H
+
+#include <string>
+
+#include "interp.h"
+#include "gamma.h"
+
+// Pi-Blaster only drives GPIO numbers below 32, so that bounds the channels
+#define MAX_CHANNELS 32
+#define MAX_GROUPS   16
+
+// What a channel does within its group
+#define ROLE_RED   0
+#define ROLE_GREEN 1
+#define ROLE_BLUE  2
+#define ROLE_WHITE 3
+
+// Three pins (GPIO 23, 24, 25) driving Red, Green and Blue respectively
+#define DEFAULT_FIXTURE "rgb:23,24,25"
+
+// Runtime description of the attached lights plus the per channel state the
+// render thread works on. A group is one light (an RGB or RGBW strip) and
+// every color command is applied to every group. Each per channel value
+// lives in its own contiguous array so the render loop can handle all
+// channels in a single pass without per color code paths.
+struct fixtureTable {
+   unsigned int numChannels;
+   unsigned int numGroups;
+   unsigned char pin[MAX_CHANNELS];
+   unsigned char role[MAX_CHANNELS];
+   unsigned char group[MAX_CHANNELS];
+   const gammaCurve *curve[MAX_CHANNELS];
+   bool groupHasWhite[MAX_GROUPS];
+
+   // Q15 levels: what was last written, and where the current ramp started
+   // from, how far it goes and where it ends up
+   level_t level[MAX_CHANNELS];
+   level_t rampStart[MAX_CHANNELS];
+   level_t rampDelta[MAX_CHANNELS];
+   level_t rampTarget[MAX_CHANNELS];
+};
+
+// Parse a fixture description into fixture. Groups are separated by '/' and
+// each is a channel order followed by the GPIO pins in that order, e.g.
+// "rgb:23,24,25/grbw:4,17,18,22". A group may end in "@curve" to pick its
+// own gamma curve, otherwise it uses defaultGamma. Returns false with a
+// message in error if the description is invalid.
+bool parseFixture(const std::string &spec, const std::string &defaultGamma, fixtureTable &fixture, std::string &error);
+
+// Work out the level of every channel for an RGB color. Groups with a white
+// channel take the common part of the three colors on white.
+void colorToLevels(const fixtureTable &fixture, double red, double green, double blue, level_t *levels);
+
+// The letter used for a role in fixture descriptions
+char roleName(unsigned char role);
+
+#endif
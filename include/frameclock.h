@@ -0,0 +1,58 @@
+#ifndef FRAMECLOCK_H
+#define FRAMECLOCK_H
+
+#include <stdint.h>
+#include <poll.h>
+
+// Deadline value meaning "nothing scheduled, wait for an event"
+#define NO_DEADLINE UINT64_MAX
+
+// Default number of frames per second written while ramping
+#define DEFAULT_FRAME_RATE 200
+
+// Frame scheduler built on absolute CLOCK_MONOTONIC deadlines.
+//
+// Frames are placed on a grid anchored at the start of whatever is being
+// animated (origin + k * period), so time spent writing the output or
+// waking up late never pushes later frames back. Waiting is done on a
+// timerfd armed with TFD_TIMER_ABSTIME so it can be combined with other
+// descriptors in a single poll().
+class FrameClock {
+public:
+   FrameClock();
+   ~FrameClock();
+
+   // Monotonic time in microseconds
+   static uint64_t now();
+
+   void setFrameRate(unsigned int fps);
+   unsigned int frameRate() const { return fps; }
+   uint64_t framePeriod() const { return period; }
+
+   // The first frame boundary strictly after now on the grid anchored at origin
+   uint64_t nextFrame(uint64_t origin, uint64_t now) const;
+
+   // The first frame boundary at or after time on the grid anchored at origin
+   uint64_t frameAtOrAfter(uint64_t origin, uint64_t time) const;
+
+   // Sleep until the absolute deadline (or forever for NO_DEADLINE) or until
+   // one of the extra descriptors becomes readable. Returns true if the
+   // deadline was reached.
+   bool waitUntil(uint64_t deadline, struct pollfd *fds, unsigned int numFds);
+
+   int fd() const { return timerFd; }
+
+   // Arm (or disarm for NO_DEADLINE) the timerfd without waiting on it
+   void arm(uint64_t deadline);
+
+   // Consume a pending expiry of the timerfd
+   void acknowledge();
+
+private:
+   int timerFd;
+   unsigned int fps;
+   uint64_t period;
+   uint64_t armedDeadline;
+};
+
+#endif
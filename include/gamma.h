@@ -0,0 +1,41 @@
+#ifndef GAMMA_H
+#define GAMMA_H
+
+#include <string>
+
+#include "interp.h"
+
+// Curves are tabulated at every 8th Q15 level plus full on, and the three
+// low bits interpolate between neighbouring entries
+#define GAMMA_INDEX_SHIFT 3
+#define GAMMA_ENTRIES     ((LEVEL_MAX >> GAMMA_INDEX_SHIFT) + 2)
+
+// The curve used when none is given
+#define DEFAULT_GAMMA "cie"
+
+// A brightness curve mapping perceptual levels (what commands, ramps and
+// the keyboard work in) to linear PWM duty, both as Q15. Tables are built
+// once when the curve is loaded, so the output path never calls pow().
+struct gammaCurve {
+   std::string name;
+   level_t table[GAMMA_ENTRIES];
+};
+
+// Find or build the curve for spec: "linear", "cie" (CIE 1931 lightness)
+// or a gamma exponent such as "2.2". Curves are shared between every
+// channel that asks for the same one. Returns NULL with a message in
+// error if spec isn't a curve.
+const gammaCurve *loadGammaCurve(const std::string &spec, std::string &error);
+
+// Map a perceptual level to duty
+inline level_t gammaApply(const gammaCurve *curve, level_t level) {
+   if ( level <= 0 ) return 0;
+   if ( level >= LEVEL_MAX ) return LEVEL_MAX;
+   unsigned int index = (unsigned int)level >> GAMMA_INDEX_SHIFT;
+   int32_t low = curve->table[index];
+   int32_t high = curve->table[index + 1];
+   int32_t frac = level & ((1 << GAMMA_INDEX_SHIFT) - 1);
+   return (level_t)(low + (((high - low) * frac) >> GAMMA_INDEX_SHIFT));
+}
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef INTERP_H
+#define INTERP_H
+
+#include <stdint.h>
+
+// Channel levels are Q15 fixed point: 0 is off and LEVEL_MAX is full on
+typedef int16_t level_t;
+#define LEVEL_MAX 32767
+
+// Ramp progress is a Q15 fraction in [0, FRACTION_ONE)
+#define FRACTION_BITS 15
+#define FRACTION_ONE  (1 << FRACTION_BITS)
+
+// The interpolation kernel computes, for every channel i,
+//
+//    out[i] = start[i] + ((delta[i] * fraction) >> 15)
+//
+// with a 32 bit product and an arithmetic (flooring) shift. delta is
+// target - start, so it always fits in 16 bits, and the vector paths use
+// instructions that produce exactly the same rounding, so every path gives
+// bit-identical results.
+
+// Convert a level between 0.0 and 1.0 (clamped) to Q15
+level_t levelFromDouble(double level);
+
+// How far through a ramp elapsed is, as a Q15 fraction below FRACTION_ONE
+int16_t rampFraction(uint64_t elapsed, uint64_t duration);
+
+// The earliest elapsed time at which a ramp from start by delta over
+// duration gives a level at or past level (in the direction of delta)
+uint64_t rampTimeToReach(level_t start, level_t delta, level_t level, uint64_t duration);
+
+// Interpolate n channels one at a time
+void interpolateScalar(const level_t *start, const level_t *delta, level_t *out, unsigned int n, int16_t fraction);
+
+// Interpolate n channels eight at a time with SSE2 or NEON when the target
+// has them. Channels past the last multiple of eight use the scalar path.
+void interpolateVector(const level_t *start, const level_t *delta, level_t *out, unsigned int n, int16_t fraction);
+
+// Name of the vector instruction set interpolateVector() uses ("none" if
+// it always falls back to the scalar path)
+const char *interpolateVectorName();
+
+// The fastest available path
+inline void interpolate(const level_t *start, const level_t *delta, level_t *out, unsigned int n, int16_t fraction) {
+   interpolateVector(start, delta, out, n, fraction);
+}
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef JITTERBUFFER_H
+#define JITTERBUFFER_H
+
+#include <atomic>
+
+#include <stdint.h>
+
+// Frames held at once. Frames further ahead of the one being played than
+// this are taken to mean the stream was restarted.
+#define JITTER_SLOTS 32
+
+// Default time frames are held back before they are played, in ms
+#define DEFAULT_JITTER_DELAY 50
+
+// Frame period assumed until two consecutive frames have been played, and
+// the range a measured one is trusted in, in microseconds
+#define STREAM_DEFAULT_PERIOD 25000
+#define STREAM_MIN_PERIOD     1000
+#define STREAM_MAX_PERIOD     1000000
+
+// A stream with nothing buffered that hasn't been heard from for this long
+// (microseconds) has ended
+#define STREAM_TIMEOUT 1000000
+
+// Results of JitterBuffer::play()
+#define STREAM_IDLE      0 // Nothing is due yet
+#define STREAM_FRAME     1 // A received frame is due
+#define STREAM_CONCEALED 2 // A lost frame was replaced by interpolating
+#define STREAM_UNDERRUN  3 // Nothing to play; keep showing the last frame
+#define STREAM_ENDED     4 // The stream timed out
+
+// One frame of a stream
+struct streamFrame {
+   uint8_t red;
+   uint8_t green;
+   uint8_t blue;
+};
+
+// Playout buffer for streamed frames.
+//
+// Every frame carries a sequence number and the sender's timestamp in
+// milliseconds. The first frame of a stream ties the sender's clock to
+// ours; after that each frame is due at its timestamp plus the playout
+// delay, so frames are played at the rate they were sent no matter how
+// unevenly they arrive. A frame that turns up after its slot was played
+// is late and dropped. A single missing frame is replaced by the midpoint
+// of its neighbours. When the next frame hasn't arrived at all the buffer
+// underruns: playout stalls for a frame period and the last frame stays
+// on. Frames that arrive much earlier than needed, e.g. after a stall,
+// pull playout forward again so the delay doesn't keep growing.
+//
+// Only the engine may call insert(), play() and reset(); the counters can
+// be read from anywhere.
+class JitterBuffer {
+public:
+   JitterBuffer();
+
+   // Playout delay in microseconds
+   void setDelay(uint64_t micros) { delay = micros; }
+   uint64_t playoutDelay() const { return delay; }
+
+   // Add a frame that arrived at local time now. Returns false if it was
+   // late or a duplicate.
+   bool insert(uint32_t sequence, uint32_t timestamp, const streamFrame &frame, uint64_t now);
+
+   // Work out what to show at local time now. Returns one of the STREAM_
+   // results; frame is set for STREAM_FRAME and STREAM_CONCEALED.
+   int play(uint64_t now, streamFrame &frame);
+
+   // The local time play() next has something to do, or NO_DEADLINE
+   uint64_t nextDue() const;
+
+   // Forget the stream
+   void reset();
+
+   bool active() const { return started; }
+
+   unsigned int depth() const { return depthShown; }
+   unsigned int maxDepth() const { return maxDepthShown; }
+   unsigned long played() const { return playedCount; }
+   unsigned long late() const { return lateCount; }
+   unsigned long concealed() const { return concealedCount; }
+   unsigned long underruns() const { return underrunCount; }
+
+private:
+   struct slot {
+      bool used;
+      uint32_t sequence;
+      uint32_t timestamp;
+      streamFrame frame;
+   };
+
+   // Local time a sender timestamp is due at
+   uint64_t dueAt(uint32_t timestamp) const;
+   void start(uint32_t sequence, uint32_t timestamp, uint64_t now);
+   void take(slot &s);
+
+   slot slots[JITTER_SLOTS];
+   bool started;
+   uint64_t delay;
+
+   // Sender timestamps are counted in ms from baseTimestamp, which was
+   // received at local time baseTime (plus any stalls since)
+   uint32_t baseTimestamp;
+   uint64_t baseTime;
+
+   uint32_t nextSequence;   // The next frame to play
+   uint32_t lastTimestamp;  // Timestamp of the frame played last
+   uint64_t period;         // Measured time between frames
+   uint64_t lastArrival;
+   streamFrame lastFrame;
+   unsigned int buffered;
+   bool lastReceived;       // The last frame played was received, not made up
+   bool stalled;            // Waiting for frames since the buffer ran dry
+
+   std::atomic<unsigned int> depthShown;
+   std::atomic<unsigned int> maxDepthShown;
+   std::atomic<unsigned long> playedCount;
+   std::atomic<unsigned long> lateCount;
+   std::atomic<unsigned long> concealedCount;
+   std::atomic<unsigned long> underrunCount;
+};
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef MULTICAST_H
+#define MULTICAST_H
+
+#include <string>
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+// Group addresses are the base plus the target ID, so by default ID 5
+// listens on 239.65.65.5. The base itself is the group for messages sent
+// to all targets.
+#define DEFAULT_MULTICAST_BASE "239.65.65.0"
+
+// Default UDP port for commands
+#define DEFAULT_UDP_PORT 6565
+
+// The group carrying messages for target ID id (1 - 64), or for all
+// targets when id is 0. Addresses are in network byte order.
+in_addr_t multicastGroup(in_addr_t base, unsigned int id);
+
+// Parse a dotted quad multicast address. Returns false if it isn't one.
+bool parseMulticastBase(const std::string &spec, in_addr_t &base);
+
+// Move sock from the groups for oldMembership to those for newMembership
+// on the interface with local address iface (INADDR_ANY for the default).
+// The all targets group is always kept, and firstJoin also stops the
+// socket receiving groups it didn't join itself. A node answering to every
+// ID joins only the all group. Returns the number of groups joined, with
+// a message in error if any join failed (e.g. over the kernel's
+// igmp_max_memberships or no multicast route).
+unsigned int updateMulticastGroups(int sock, in_addr_t base, in_addr_t iface, uint64_t oldMembership, uint64_t newMembership, bool firstJoin, std::string &error);
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef OUTPUTBACKEND_H
+#define OUTPUTBACKEND_H
+
+#include <string>
+
+#include <stdint.h>
+
+// Pi-Blaster only drives GPIO numbers below this
+#define OUTPUT_MAX_PINS 32
+
+// Duty cycles are handed over as integers out of OUTPUT_DUTY_SCALE
+#define OUTPUT_DUTY_SCALE 10000
+
+// Most backends frames can be sent to at once
+#define OUTPUT_MAX_BACKENDS 4
+
+// One frame as every backend sees it: the duty of every pin in use, in
+// the order the pins were first set
+struct outputFrame {
+   uint64_t time;       // Monotonic microseconds of the last change
+   uint32_t sequence;   // Counts frames with a change from 1, skipping 0
+   bool changed;        // Some duty differs from the previous frame
+   unsigned int numPins;
+   uint8_t pin[OUTPUT_MAX_PINS];
+   uint16_t duty[OUTPUT_MAX_PINS];
+};
+
+// Something frames are written to: Pi-Blaster's text protocol
+// (OutputWriter), binary frame records (BinaryOutput) or a shared memory
+// ring (ShmRing). write() is called for every frame, changed or not, and
+// must not block or allocate. A backend that couldn't finish a frame says
+// so through pending(); the engine then keeps flushing once a frame
+// period, even with nothing animating, until it is out.
+class OutputBackend {
+public:
+   virtual ~OutputBackend() {}
+
+   // Take frame. Returns false if it was dropped.
+   virtual bool write(const outputFrame &frame) = 0;
+
+   // True while part or all of the last frame still has to go out
+   virtual bool pending() const = 0;
+
+   virtual unsigned long framesWritten() const = 0;
+   virtual unsigned long framesDropped() const = 0;
+};
+
+// Fans each frame out to several backends. Duties are staged with set()
+// as they were for a single writer, and flush() builds the frame once and
+// hands the same one to every backend.
+class OutputSet {
+public:
+   OutputSet();
+
+   // Send frames to backend from now on. The set doesn't take ownership.
+   // Returns false if there are already OUTPUT_MAX_BACKENDS.
+   bool add(OutputBackend *backend, const std::string &name);
+
+   // Stage a duty cycle (0 - OUTPUT_DUTY_SCALE) for pin for the next frame
+   void set(unsigned int pin, unsigned int duty);
+
+   // Write the frame to every backend. Returns false if any dropped it.
+   bool flush();
+
+   // True while some backend still has to finish the last frame. The
+   // frame stays staged, so calling flush() again retries it.
+   bool pending() const;
+
+   unsigned int count() const { return numBackends; }
+   const OutputBackend *backend(unsigned int i) const { return backends[i]; }
+   const std::string &name(unsigned int i) const { return names[i]; }
+
+private:
+   outputFrame frame;
+
+   // Where each pin is in frame, or -1 if it isn't in use yet
+   int slot[OUTPUT_MAX_PINS];
+
+   OutputBackend *backends[OUTPUT_MAX_BACKENDS];
+   std::string names[OUTPUT_MAX_BACKENDS];
+   unsigned int numBackends;
+};
+
+// Open an extra backend from a spec such as "binary:/tmp/frames",
+// "shm:/dev/shm/pwmcolors" or "text:/dev/pi-blaster2". Files and FIFOs are
+// opened non-blocking, so like the main device a FIFO needs its reader
+// first. Returns NULL with a message in error if that isn't possible.
+OutputBackend *openOutput(const std::string &spec, std::string &error);
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef OUTPUTWRITER_H
+#define OUTPUTWRITER_H
+
+#include <atomic>
+
+#include "telemetry.h"
+#include "outputbackend.h"
+
+// Longest line we ever format: "31=0.1234\n"
+#define OUTPUT_MAX_LINE 10
+
+// Allocation free writer for the Pi-Blaster text protocol.
+//
+// Channels are staged with set() and flush() formats every channel whose
+// value changed since the last frame into a preallocated buffer with a
+// hand-rolled fixed-point formatter, then hands the whole frame to the
+// kernel in exactly one write(). Short writes are finished first thing on
+// the next frame, so Pi-Blaster never sees half a line followed by a new
+// one. If the device can't take anything (EAGAIN) the frame is dropped and
+// its channels stay staged so the next frame carries them. Any other error
+// (the reader of a FIFO went away, a full disk) won't clear up by trying
+// again, so that frame and any tail are dropped for good. Duties are
+// written with four decimal places.
+class OutputWriter : public OutputBackend {
+public:
+   OutputWriter();
+
+   void setFd(int newFd) { fd = newFd; }
+   int getFd() const { return fd; }
+
+   // Stage a duty cycle (0 - OUTPUT_DUTY_SCALE) for pin for the next frame
+   void set(unsigned int pin, unsigned int duty);
+
+   // Write all changed channels. Returns false if the frame was dropped.
+   bool flush();
+
+   // Stage every pin of frame and flush, as a backend of an OutputSet
+   bool write(const outputFrame &frame);
+
+   // True if a frame was dropped or a short write left a tail, so a staged
+   // pin still differs from what the device has
+   bool pending() const;
+
+   // Forget what was last written so the next frame sends every staged pin
+   void invalidate();
+
+   // Format one "pin=duty\n" line into out and return its length
+   static unsigned int formatLine(char *out, unsigned int pin, unsigned int duty);
+
+   unsigned long bytesWritten() const { return bytesCount.load(std::memory_order_relaxed); }
+   unsigned long framesWritten() const { return framesCount.load(std::memory_order_relaxed); }
+   unsigned long framesDropped() const { return droppedCount.load(std::memory_order_relaxed); }
+   unsigned long partialWrites() const { return partialCount.load(std::memory_order_relaxed); }
+   unsigned long eagains() const { return eagainCount.load(std::memory_order_relaxed); }
+   unsigned long writeErrors() const { return errorCount.load(std::memory_order_relaxed); }
+
+   // How long each write() to the device took, in microseconds
+   const Histogram &writeTimes() const { return writeTime; }
+
+private:
+   int fd;
+
+   // Latest duty per pin and what the device was last sent. A pin not
+   // yet written has lastDuty set past the scale so it always differs.
+   unsigned int stagedDuty[OUTPUT_MAX_PINS];
+   unsigned int lastDuty[OUTPUT_MAX_PINS];
+
+   // Pins in the order they were first staged, so lines come out in a
+   // stable order and flush() only looks at pins in use
+   unsigned char pinOrder[OUTPUT_MAX_PINS];
+   unsigned int numPins;
+   bool inUse[OUTPUT_MAX_PINS];
+
+   // The unwritten tail of the last frame (always at the start of buf)
+   // followed by room for one full new frame
+   char buf[OUTPUT_MAX_PINS * OUTPUT_MAX_LINE * 2];
+   unsigned int tailLength;
+
+   std::atomic<unsigned long> bytesCount;
+   std::atomic<unsigned long> framesCount;
+   std::atomic<unsigned long> droppedCount;
+   std::atomic<unsigned long> partialCount;
+   std::atomic<unsigned long> eagainCount;
+   std::atomic<unsigned long> errorCount;
+   Histogram writeTime;
+};
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef PACKET_H
+#define PACKET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+
+struct colorCommand;
+
+// The two 32 bit filter words every packet starts with, and the same two
+// read as one little endian 64 bit word so they can be checked with a
+// single compare
+#define PACKET_FILTER_1 4039196302U
+#define PACKET_FILTER_2 3194769291U
+#define PACKET_MAGIC    (((uint64_t)PACKET_FILTER_2 << 32) | PACKET_FILTER_1)
+
+// Filter_1, Filter_2, MessageID, CMD and the TargetID bitfield
+#define PACKET_HEADER_SIZE 21
+
+// Bytes per color triplet in CMD_AUTOPATTERN: R, G, B and RestTime
+#define PACKET_TRIPLET_SIZE 7
+
+// CMD_PATTERNCHUNK fields before the step data: PatternID, Sequence,
+// Offset, Total, RampTime and Encoding
+#define PACKET_CHUNK_HEADER_SIZE 12
+
+// CMD_AT fields before the wrapped command: ExecuteAt and CMD
+#define PACKET_AT_HEADER_SIZE 9
+
+// CMD_EFFECT fields before the palette: Type, Period, Seed and NumColors
+#define PACKET_EFFECT_HEADER_SIZE 10
+
+// Bytes per palette color in CMD_EFFECT: R, G and B
+#define PACKET_EFFECT_COLOR_SIZE 3
+
+// Target membership of a node that answers to every target ID
+#define TARGETS_ALL (~(uint64_t)0)
+
+// Results of parsePacket()
+#define PARSE_OK           0
+#define PARSE_BAD_MAGIC    1 // Not one of our packets at all
+#define PARSE_TRUNCATED    2 // Shorter than its header or command needs
+#define PARSE_UNKNOWN_CMD  3 // Valid header but a command we don't know
+
+// Load little endian values from anywhere in a datagram. memcpy keeps this
+// safe on CPUs that fault on unaligned loads and compiles to a plain load
+// where they don't.
+inline uint32_t packetLoad32(const unsigned char *p) {
+   uint32_t value;
+   memcpy(&value, p, 4);
+   return value;
+}
+
+inline uint16_t packetLoad16(const unsigned char *p) {
+   uint16_t value;
+   memcpy(&value, p, 2);
+   return value;
+}
+
+inline uint64_t packetLoad64(const unsigned char *p) {
+   uint64_t value;
+   memcpy(&value, p, 8);
+   return value;
+}
+
+// A decoded packet. Nothing is copied out of the datagram: variable length
+// data such as the pattern triplets is left in place and read through
+// tripletAt(), so the view is only valid while the receive buffer is.
+struct packetCommand {
+   uint32_t messageID;
+   uint8_t command;
+   uint64_t targets;
+
+   // CMD_STOREPATTERN, CMD_PLAYPATTERN and CMD_PATTERNCHUNK
+   uint8_t patternID;
+
+   // CMD_SETLEVELS, CMD_AUTOPATTERN, CMD_STOREPATTERN and CMD_PATTERNCHUNK
+   uint32_t rampDuration;
+
+   // CMD_PATTERNCHUNK. The step data is left in the datagram.
+   uint16_t chunkSequence;
+   uint16_t chunkOffset;
+   uint16_t chunkTotal;
+   uint8_t chunkEncoding;
+   const unsigned char *chunkData;
+   size_t chunkLength;
+
+   // CMD_STREAMFRAME: the frame's sequence number and the sender's
+   // timestamp in milliseconds
+   uint32_t streamSequence;
+   uint32_t streamTimestamp;
+
+   // CMD_SETLEVELS and CMD_STREAMFRAME
+   uint8_t red;
+   uint8_t green;
+   uint8_t blue;
+
+   // Shared time in microseconds to run the command at when it came
+   // wrapped in CMD_AT, otherwise 0. command is then the wrapped command.
+   uint64_t executeAt;
+
+   // CMD_TIMESYNC: the controller's clock in microseconds
+   uint64_t syncTime;
+
+   // CMD_EFFECT: the effect, its period in milliseconds, the seed and the
+   // palette, effectColors[i * PACKET_EFFECT_COLOR_SIZE] being R, G, B of
+   // color i. Every color has been checked to be in the datagram.
+   uint8_t effectType;
+   uint32_t effectPeriod;
+   uint32_t effectSeed;
+   uint8_t numEffectColors;
+   const unsigned char *effectColors;
+
+   // CMD_SETTARGETS: the new membership mask, TARGETS_ALL for "all"
+   uint64_t membership;
+
+   // CMD_AUTOPATTERN and CMD_STOREPATTERN. Every triplet has been checked to be in the datagram.
+   uint8_t numColors;
+   const unsigned char *colors;
+
+   void tripletAt(unsigned int i, uint8_t &r, uint8_t &g, uint8_t &b, uint32_t &rest) const {
+      const unsigned char *p = colors + (i * PACKET_TRIPLET_SIZE);
+      r = p[0];
+      g = p[1];
+      b = p[2];
+      rest = packetLoad32(p + 3);
+   }
+};
+
+// Validate and decode the length bytes at data. Packets without the magic
+// filter words are rejected before anything else is looked at, and every
+// field is checked against the real datagram length before it is read.
+// Returns one of the PARSE_ results; cmd is only filled in on PARSE_OK.
+int parsePacket(const unsigned char *data, size_t length, packetCommand &cmd);
+
+// True if a packet sent to targets is for a node with this membership mask.
+// A zero bitfield is for everyone, and a node listening to everything has
+// all bits set, so there is nothing to work out per packet.
+inline bool packetIsForUs(uint64_t targets, uint64_t membership) {
+   return (targets == 0) | ((targets & membership) != 0);
+}
+
+// Build a membership mask from a list of target IDs and ranges such as
+// "3,7,20-24". "0" (or nothing) means every target. Returns false with a
+// message in error if the list isn't valid.
+bool parseTargetIDs(const std::string &spec, uint64_t &membership, std::string &error);
+
+// The reverse of parseTargetIDs() for display, e.g. "3,7,20-24" or "all"
+std::string targetIDsToString(uint64_t membership);
+
+// Fill in the engine command for a decoded packet. Colors become 0.0 - 1.0
+// and the pattern and palette are copied out of the datagram, truncated to
+// what a command holds, so cmd outlives the receive buffer. queuedAt is
+// left for the caller to stamp.
+void commandFromPacket(const packetCommand &packet, colorCommand &cmd);
+
+// Write a packet header to out (which must hold PACKET_HEADER_SIZE bytes)
+// and return its length. Used by tools and benchmarks that build packets.
+size_t buildPacketHeader(unsigned char *out, uint32_t messageID, uint8_t command, uint64_t targets);
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef PATTERNSTORE_H
+#define PATTERNSTORE_H
+
+#include <stdint.h>
+
+#include "pwmcolors.h"
+
+// Number of patterns a node can hold. Pattern IDs are 0 - PATTERN_SLOTS-1.
+#define PATTERN_SLOTS 64
+
+// Most steps in one pattern. Patterns longer than MAX_TRIPLETS can only
+// be sent with the chunked upload (CMD_PATTERNCHUNK).
+#define PATTERN_MAX_STEPS 1024
+
+// One step of a stored pattern, at the 8 bit resolution of the protocol
+struct patternStep {
+   uint8_t red;
+   uint8_t green;
+   uint8_t blue;
+   uint32_t restDuration;
+};
+
+// A pattern as kept on the node, ready to be played without any decoding.
+// Only the first numColors steps are meaningful.
+struct storedPattern {
+   bool used;
+   unsigned int rampDuration;
+   unsigned int numColors;
+   patternStep colors[PATTERN_MAX_STEPS];
+};
+
+// The step for a color given as 0.0 - 1.0 values
+patternStep stepFromTriplet(const colorTriplet &color);
+
+// Copy the meaningful part of a pattern
+void copyPattern(storedPattern &to, const storedPattern &from);
+
+// Fixed table of patterns addressed by ID. Controllers upload a pattern
+// once with CMD_STOREPATTERN or CMD_PATTERNCHUNK and from then on switch
+// to it with a tiny CMD_PLAYPATTERN. The keyboard presets live here too.
+//
+// Only the engine (render thread or event loop) may use it.
+class PatternStore {
+public:
+   PatternStore();
+
+   // Put a pattern under id, replacing whatever was there. Returns false
+   // if id is out of range or there are no steps.
+   bool store(unsigned int id, unsigned int rampDuration, const patternStep *steps, unsigned int numSteps);
+   bool store(unsigned int id, unsigned int rampDuration, const colorTriplet *colors, unsigned int numColors);
+
+   // The pattern stored under id, or NULL if there isn't one
+   const storedPattern *find(unsigned int id) const;
+
+   unsigned int count() const { return used; }
+
+private:
+   storedPattern patterns[PATTERN_SLOTS];
+   unsigned int used;
+};
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef PATTERNUPLOAD_H
+#define PATTERNUPLOAD_H
+
+#include <atomic>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "patternstore.h"
+#include "packet.h"
+
+// Step encodings of a CMD_PATTERNCHUNK
+#define CHUNK_RAW   0 // R, G, B, RestTime (7 bytes) per step
+#define CHUNK_DELTA 1 // Delta/run length opcodes, see below
+
+// Delta encoding opcodes. Every chunk decodes on its own, so the first
+// opcode of a chunk must be CHUNK_OP_STEP.
+#define CHUNK_OP_STEP   0x00 // R G B RestTime(32): one step given outright
+#define CHUNK_OP_DELTAS 0x01 // n, then n x (dR dG dB): each step is the one
+                             // before plus its signed delta, same rest time
+#define CHUNK_OP_RUN    0x02 // n dR dG dB: n steps each adding the same delta.
+                             // A zero delta repeats the step before.
+
+// Finished uploads waiting to be copied into the store by the engine
+#define UPLOAD_BUFFERS 2
+
+// Decode the steps of one chunk into out, which has room for maxSteps.
+// Returns the number of steps decoded, or -1 if the data is malformed or
+// would decode to more than maxSteps.
+int decodeChunkSteps(const unsigned char *data, size_t length, unsigned int encoding, patternStep *out, unsigned int maxSteps);
+
+// Delta encode as many of the numSteps steps as fit in outSize bytes.
+// Returns the number of bytes used; consumed is set to the steps encoded.
+size_t encodeChunkSteps(const patternStep *steps, unsigned int numSteps, unsigned char *out, size_t outSize, unsigned int &consumed);
+
+// Reassembles chunked pattern uploads into preallocated buffers.
+//
+// An upload is identified by its pattern ID, sequence number and total
+// step count. Chunks can arrive in any order and repeat; a chunk for a
+// different upload abandons the one in progress. Once every step has
+// arrived the buffer is handed to the engine, which copies the pattern
+// into the store and then calls release().
+//
+// addChunk() may only be called from the receive thread. The engine may
+// call the accessors and release() for a buffer it was handed.
+class PatternUpload {
+public:
+   PatternUpload();
+
+   // Add one chunk. Returns the buffer holding the finished pattern when
+   // this chunk completes an upload, otherwise -1.
+   int addChunk(const packetCommand &chunk);
+
+   uint8_t patternID(int buffer) const { return uploads[buffer].patternID; }
+   unsigned int rampDuration(int buffer) const { return uploads[buffer].rampDuration; }
+   unsigned int numSteps(int buffer) const { return uploads[buffer].total; }
+   const patternStep *steps(int buffer) const { return uploads[buffer].steps; }
+
+   void release(int buffer) { uploads[buffer].handedOver.store(false, std::memory_order_release); }
+
+   unsigned long chunks() const { return chunkCount; }
+   unsigned long completed() const { return completedCount; }
+   unsigned long rejected() const { return rejectedCount; }
+
+private:
+   struct upload {
+      std::atomic<bool> handedOver;
+      uint8_t patternID;
+      uint16_t sequence;
+      uint16_t total;
+      unsigned int rampDuration;
+      unsigned int filled;
+      uint64_t received[PATTERN_MAX_STEPS / 64];
+      patternStep steps[PATTERN_MAX_STEPS];
+   };
+
+   upload uploads[UPLOAD_BUFFERS];
+   int current;
+   patternStep scratch[PATTERN_MAX_STEPS];
+
+   // The last upload finished, so late repeats of its chunks are ignored
+   bool haveFinished;
+   uint8_t finishedID;
+   uint16_t finishedSequence;
+
+   std::atomic<unsigned long> chunkCount;
+   std::atomic<unsigned long> completedCount;
+   std::atomic<unsigned long> rejectedCount;
+};
+
+#endif
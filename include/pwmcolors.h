@@ -0,0 +1,57 @@
+#ifndef PWMCOLORS_H
+#define PWMCOLORS_H
+
+#include <stdint.h>
+
+#include "effects.h"
+
+#define CMD_OFF         0x00
+#define CMD_SETLEVELS   0x01
+#define CMD_AUTOPATTERN 0x02
+#define CMD_AUTODISABLE 0x03
+#define CMD_SETTARGETS  0x04
+#define CMD_STOREPATTERN 0x05
+#define CMD_PLAYPATTERN 0x06
+#define CMD_PATTERNCHUNK 0x07
+#define CMD_STREAMFRAME 0x08
+#define CMD_TIMESYNC    0x09
+#define CMD_AT          0x0A
+#define CMD_EFFECT      0x0B
+#define CMD_QUERY       0x0C
+
+// Internal commands, never accepted from the network
+#define CMD_ADJUSTLEVELS 0x80 // Nudge the static levels by colors[0]
+#define CMD_SHUTDOWN     0x81 // Turn everything off and stop the render thread
+#define CMD_STOREUPLOAD  0x82 // Store the finished upload in buffer uploadBuffer
+
+// The input buffer can hold a max of 35 full triplets plus the header
+#define MAX_TRIPLETS    35
+
+// Struct for storing color/PWM value sets
+// Colors are obvious. restDuration is how long to rest on this color.
+struct colorTriplet {
+   double red;
+   double green;
+   double blue;
+   unsigned int restDuration;
+};
+
+// A fully decoded command as handed from the receiver to the render thread.
+// Everything is copied by value so the receiver never shares a buffer with
+// the thread executing the command.
+struct colorCommand {
+   uint64_t queuedAt; // Monotonic microseconds when the command was queued
+   uint64_t executeAt; // Shared time to run at (CMD_AT), or 0 for right away
+   uint64_t syncTime; // CMD_TIMESYNC
+   unsigned char command;
+   unsigned char patternID; // CMD_STOREPATTERN and CMD_PLAYPATTERN
+   unsigned char uploadBuffer; // CMD_STOREUPLOAD
+   uint32_t streamSequence; // CMD_STREAMFRAME
+   uint32_t streamTimestamp;
+   effectParams effect; // CMD_EFFECT
+   unsigned int rampDuration;
+   unsigned char numColors;
+   colorTriplet colors[MAX_TRIPLETS];
+};
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <string>
+
+#include <pthread.h>
+
+// SCHED_FIFO priority used by --rt without a value. The kernel's threaded
+// interrupt handlers run at 50; going above them would hold up the network
+// and the PWM DMA behind our frames.
+#define DEFAULT_RT_PRIORITY 50
+
+// Stack size of threads started once memory is locked. Every page of a
+// locked stack is resident, so the default of several megabytes per
+// thread would be wasted; none of our threads needs more than this.
+#define RT_THREAD_STACK (256 * 1024)
+
+// How much of the real-time thread's stack is touched before it starts
+// its loop, so a deep call in the middle of a frame never page faults
+#define RT_STACK_PREFAULT (64 * 1024)
+
+// Opt-in real-time setup for the thread that renders frames (--rt, --cpu).
+//
+// Nothing here is needed for correct output; it only keeps frames on time
+// while the rest of the system is busy. The process locks its memory once
+// startup is done, the render thread (or the event loop thread) is moved
+// to SCHED_FIFO and optionally pinned to one CPU, and the thread touches
+// its stack before entering its loop. The render thread's loop never
+// allocates, so from then on it doesn't page fault or wait behind ordinary
+// processes. The event loop also draws the status screen and answers
+// CMD_QUERY, which do allocate, so that guarantee is only for the threaded
+// mode.
+struct realtimeConfig {
+   bool enabled;   // --rt: lock memory and use SCHED_FIFO
+   int priority;   // SCHED_FIFO priority, 1 - 99
+   int cpu;        // CPU to pin the render thread to, -1 for any
+};
+
+// Lock every current and future page of the process into memory, stop
+// malloc from handing memory back to the kernel (so it never has to be
+// faulted in again) and make threads started from now on use
+// RT_THREAD_STACK. Call once after startup, before starting any thread.
+bool lockMemory(std::string &error);
+
+// Move thread to SCHED_FIFO at config's priority if config is enabled and
+// pin it to config's CPU if one was given. Returns false with a message in
+// error if any part could not be applied, usually for lack of privilege.
+bool enterRealtime(pthread_t thread, const realtimeConfig &config, std::string &error);
+
+// Touch RT_STACK_PREFAULT bytes of the calling thread's stack
+void prefaultStack();
+
+// One line description of config once applied, e.g. "SCHED_FIFO 50, memory
+// locked, CPU 2"
+std::string realtimeDescription(const realtimeConfig &config, bool locked);
+
+#endif
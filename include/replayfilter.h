@@ -0,0 +1,55 @@
+#ifndef REPLAYFILTER_H
+#define REPLAYFILTER_H
+
+#include <atomic>
+
+#include <stdint.h>
+
+// Number of senders tracked at once, and how far behind a sender's newest
+// message ID a message may arrive and still be accepted once
+#define REPLAY_SOURCES 16
+#define REPLAY_WINDOW  64
+
+// A message ID this far behind the newest one is taken to mean the sender
+// restarted its numbering, rather than a very late duplicate
+#define REPLAY_RESYNC  4096
+
+// Duplicate suppression for UDP messages, per sender.
+//
+// Each sender (address and port) gets a sliding window over its most
+// recent message IDs, as in IPsec anti-replay: the newest ID seen plus a
+// bitmap of which of the REPLAY_WINDOW IDs before it have been seen. So
+// redundant resends are dropped even when they arrive out of order or
+// interleaved with other senders. Senders are kept in a fixed table and
+// the least recently heard one is evicted when a new one shows up.
+//
+// Only the receive thread may call accept(); the counters can be read
+// from anywhere.
+class ReplayFilter {
+public:
+   ReplayFilter();
+
+   // True the first time messageID is seen from this sender, false for a
+   // duplicate or a message too old to tell
+   bool accept(uint32_t address, uint16_t port, uint32_t messageID);
+
+   unsigned long duplicates() const { return duplicateCount; }
+   unsigned long evictions() const { return evictionCount; }
+
+private:
+   struct source {
+      uint32_t address;
+      uint16_t port;
+      bool used;
+      uint32_t newest;  // Highest message ID seen
+      uint64_t seen;    // Bit n set if newest - n has been seen
+      uint64_t lastUsed;
+   };
+
+   source sources[REPLAY_SOURCES];
+   uint64_t useCounter;
+   std::atomic<unsigned long> duplicateCount;
+   std::atomic<unsigned long> evictionCount;
+};
+
+#endif
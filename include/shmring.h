@@ -0,0 +1,84 @@
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <atomic>
+#include <string>
+
+#include <stdint.h>
+
+#include "outputbackend.h"
+
+// Identifies a ring file and its layout: "PMCR"
+#define RING_MAGIC   0x52434d50
+#define RING_VERSION 1
+
+// Frames kept in the ring. A reader that falls this far behind misses
+// frames but can always see the newest one.
+#define RING_SLOTS 256
+
+// One frame in the ring. sequence is the frame's sequence number once it
+// is complete and 0 while the writer is filling the slot in.
+struct ringSlot {
+   std::atomic<uint32_t> sequence;
+   uint32_t numPins;
+   uint64_t time;
+   uint8_t pin[OUTPUT_MAX_PINS];
+   uint16_t duty[OUTPUT_MAX_PINS];
+   uint8_t reserved[16];
+};
+
+// The ring file's contents. head is the sequence number of the newest
+// complete frame (0 before the first) and frame n lives in slot
+// n % RING_SLOTS.
+struct ringHeader {
+   uint32_t magic;
+   uint32_t version;
+   uint32_t slotCount;
+   uint32_t slotSize;
+   std::atomic<uint32_t> head;
+   uint8_t reserved[44];
+   ringSlot slots[RING_SLOTS];
+};
+
+// The frame with sequence number n in place, or NULL if its slot has
+// already been reused or is being written. Readers map the file read-only
+// and read the frame straight out of the slot, then call ringStillValid()
+// to check the writer didn't lap them while they did.
+inline const ringSlot *ringFrame(const ringHeader *ring, uint32_t n) {
+   const ringSlot *slot = &ring->slots[n % RING_SLOTS];
+   return (slot->sequence.load(std::memory_order_acquire) == n) ? slot : 0;
+}
+
+inline bool ringStillValid(const ringSlot *slot, uint32_t n) {
+   std::atomic_thread_fence(std::memory_order_acquire);
+   return slot->sequence.load(std::memory_order_relaxed) == n;
+}
+
+// Single producer, lock free ring of frames in a shared memory file (for
+// example under /dev/shm) for local consumers such as an LED simulator or
+// a recorder. Each changed frame is written straight into the mapping,
+// guarded by its slot's sequence number, and published by advancing head,
+// so the writer never waits for a reader and readers never copy more than
+// they want. Readers can't slow the writer down; if they are too slow they
+// miss frames, never get torn ones.
+class ShmRing : public OutputBackend {
+public:
+   ShmRing();
+   ~ShmRing();
+
+   // Map path, creating it if needed. Returns false with a message in error
+   // if that isn't possible.
+   bool open(const std::string &path, std::string &error);
+
+   bool write(const outputFrame &frame);
+   bool pending() const { return false; }
+
+   unsigned long framesWritten() const { return framesCount.load(std::memory_order_relaxed); }
+   unsigned long framesDropped() const { return 0; }
+
+private:
+   ringHeader *mapped;
+   std::atomic<unsigned long> framesCount;
+};
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef STATEFILE_H
+#define STATEFILE_H
+
+#include <string>
+
+#include <stdint.h>
+
+#include "effects.h"
+#include "patternstore.h"
+
+// Where the state is kept unless --state says otherwise
+#define DEFAULT_STATE_FILE "/var/lib/pwmcolors/state"
+
+// Identifies a state file and the layout of persistentState. Bump the
+// version whenever the layout changes; older files are then ignored.
+#define STATE_MAGIC   0x53434d50 // "PMCS"
+#define STATE_VERSION 3
+
+// The state file's contents, used in place through a shared mapping
+struct persistentState {
+   uint32_t magic;
+   uint32_t version;
+   uint32_t size;
+   uint32_t patternActive;
+   uint32_t effectActive;
+   double redStatic;
+   double greenStatic;
+   double blueStatic;
+   storedPattern activePattern;
+   effectParams activeEffect;
+   storedPattern patterns[PATTERN_SLOTS];
+};
+
+// Keeps what a node should look like across restarts: the static levels,
+// the pattern or effect being played and the pattern store. The file is mmap'ed, so
+// saving is a plain memory copy and the kernel writes it back in its own
+// time. Nothing is ever synced explicitly.
+//
+// The file is locked while it is open, so a second daemon on the same host
+// can't map it too and overwrite the first one's state.
+//
+// Only the engine may save; loading happens before it starts.
+class StateFile {
+public:
+   StateFile();
+   ~StateFile();
+
+   // Lock and map path, creating it if needed. Returns false with a message
+   // in error if that isn't possible, including when another process has
+   // it open; saving is then a no-op.
+   bool open(const std::string &path, std::string &error);
+
+   // The state found in the file when it was opened, or NULL if the file
+   // was new, from another version or not open
+   const persistentState *restored() const { return wasValid ? mapped : 0; }
+
+   void saveLevels(double red, double green, double blue);
+   // At most one of a pattern and an effect is playing; saving either
+   // one as active (or the pattern as inactive) ends the other
+   void saveActivePattern(bool active, const storedPattern *pattern);
+   void saveActiveEffect(const effectParams &effect);
+   void savePattern(unsigned int id, const storedPattern &pattern);
+
+private:
+   int fd;
+   persistentState *mapped;
+   bool wasValid;
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <atomic>
+#include <string>
+
+// Buckets per histogram. Bucket 0 counts zeros and bucket i counts values
+// from 2^(i-1) up to 2^i - 1, so the last one holds everything from about
+// a second up.
+#define HISTOGRAM_BUCKETS 22
+
+// Fixed bucket histogram of durations in microseconds.
+//
+// Each histogram has exactly one thread recording into it, so recording is
+// a handful of relaxed loads and stores with no locked instructions, and
+// any thread can read it at any time. A reader racing a record may see the
+// sample in the bucket but not yet in the count, which doesn't matter for
+// monitoring.
+class Histogram {
+public:
+   Histogram();
+
+   void record(unsigned long micros);
+
+   unsigned long count() const { return total.load(std::memory_order_relaxed); }
+   unsigned long max() const { return largest.load(std::memory_order_relaxed); }
+   unsigned long bucket(unsigned int i) const { return buckets[i].load(std::memory_order_relaxed); }
+
+   // Largest value bucket i can hold
+   static unsigned long bucketLimit(unsigned int i);
+
+   // Upper bound of the bucket the given percentile falls in, capped at
+   // the largest value seen. 0 if nothing was recorded.
+   unsigned long percentile(unsigned int percent) const;
+
+   // Append the histogram to out as a JSON object: count, max, p50, p99
+   // and the buckets up to the last one in use
+   void appendJSON(std::string &out) const;
+
+private:
+   std::atomic<unsigned long> buckets[HISTOGRAM_BUCKETS];
+   std::atomic<unsigned long> total;
+   std::atomic<unsigned long> largest;
+};
+
+// Add one to a counter that only the calling thread ever changes, without
+// a locked read-modify-write
+inline void bumpCounter(std::atomic<unsigned long> &counter) {
+   counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+#endif
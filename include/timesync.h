@@ -0,0 +1,57 @@
+#ifndef TIMESYNC_H
+#define TIMESYNC_H
+
+#include <atomic>
+
+#include <stdint.h>
+
+// Beacons the clock offset is estimated from
+#define SYNC_WINDOW 8
+
+// A beacon this far (microseconds) from the current estimate means the
+// controller's clock jumped, so the estimate starts over
+#define SYNC_RESET 1000000
+
+// Shared time base for playback across nodes.
+//
+// A controller sends beacons holding its clock in microseconds. A beacon
+// can only be delayed by the network, never early, so of the recent
+// beacons the one that implies the largest offset came through fastest,
+// and that offset is used (as in NTP's clock filter). The window moves on
+// with every beacon so slow drift between the clocks is followed.
+//
+// Only the engine may call addBeacon() and the conversions; the counters
+// can be read from anywhere.
+class TimeSync {
+public:
+   TimeSync();
+
+   // A beacon stamped sharedTime by the controller arrived at localTime
+   void addBeacon(uint64_t sharedTime, uint64_t localTime);
+
+   bool synced() const { return count > 0; }
+
+   // Convert between our monotonic clock and the controller's. Only
+   // meaningful once synced.
+   uint64_t toLocal(uint64_t sharedTime) const { return sharedTime - offset; }
+   uint64_t toShared(uint64_t localTime) const { return localTime + offset; }
+
+   unsigned long beacons() const { return beaconCount; }
+
+   // How far the estimate moved on the last beacon, and the spread of the
+   // offsets in the window (roughly the network jitter), in microseconds
+   long lastCorrection() const { return correctionShown; }
+   unsigned long spread() const { return spreadShown; }
+
+private:
+   uint64_t samples[SYNC_WINDOW];  // sharedTime - localTime per beacon
+   unsigned int count;
+   unsigned int next;
+   uint64_t offset;
+
+   std::atomic<unsigned long> beaconCount;
+   std::atomic<long> correctionShown;
+   std::atomic<unsigned long> spreadShown;
+};
+
+#endif
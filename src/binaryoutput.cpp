@@ -0,0 +1,66 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "binaryoutput.h"
+#include "packet.h"
+#include "telemetry.h"
+
+using namespace std;
+
+size_t encodeBinaryFrame(const outputFrame &frame, unsigned char *out) {
+   uint32_t magic = BINARY_FRAME_MAGIC;
+   unsigned char *p = out + BINARY_FRAME_HEADER;
+
+   memcpy(out, &magic, 4);
+   memcpy(out + 4, &frame.sequence, 4);
+   memcpy(out + 8, &frame.time, 8);
+   out[16] = frame.numPins;
+   for ( unsigned int i = 0; i < frame.numPins; i++ ) {
+      p[0] = frame.pin[i];
+      memcpy(p + 1, &frame.duty[i], 2);
+      p += BINARY_FRAME_PIN;
+   }
+   return p - out;
+}
+
+size_t decodeBinaryFrame(const unsigned char *data, size_t length, outputFrame &frame) {
+   const unsigned char *p = data + BINARY_FRAME_HEADER;
+
+   if ( (length < BINARY_FRAME_HEADER) || (packetLoad32(data) != BINARY_FRAME_MAGIC) ) return 0;
+   if ( (data[16] > OUTPUT_MAX_PINS) || (length - BINARY_FRAME_HEADER < (size_t)data[16] * BINARY_FRAME_PIN) ) return 0;
+
+   frame.sequence = packetLoad32(data + 4);
+   frame.time = packetLoad64(data + 8);
+   frame.numPins = data[16];
+   frame.changed = true;
+   for ( unsigned int i = 0; i < frame.numPins; i++ ) {
+      frame.pin[i] = p[0];
+      frame.duty[i] = packetLoad16(p + 1);
+      p += BINARY_FRAME_PIN;
+   }
+   return p - data;
+}
+
+BinaryOutput::BinaryOutput(int fd) : fd(fd), resend(false), framesCount(0), droppedCount(0) {
+}
+
+bool BinaryOutput::write(const outputFrame &frame) {
+   size_t length;
+   ssize_t written;
+
+   if ( !frame.changed && !resend ) return true;
+
+   length = encodeBinaryFrame(frame, buf);
+   written = ::write(fd, buf, length);
+   if ( written != (ssize_t)length ) {
+      // Nothing or, on something that isn't a FIFO, part of it went out.
+      // Only a reader that was busy is worth sending it again for.
+      resend = (written >= 0) || (errno == EAGAIN) || (errno == EWOULDBLOCK);
+      bumpCounter(droppedCount);
+      return false;
+   }
+   resend = false;
+   bumpCounter(framesCount);
+   return true;
+}
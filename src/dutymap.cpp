@@ -0,0 +1,43 @@
+#include "dutymap.h"
+
+using namespace std;
+
+level_t levelStepUp(const gammaCurve *curve, level_t level, unsigned int resolution) {
+   unsigned int step = outputStep(curve, level, resolution);
+   int low = level + 1;
+   int high = LEVEL_MAX;
+
+   // The curves are monotonic, so a binary search finds it
+   if ( (level >= LEVEL_MAX) || (outputStep(curve, LEVEL_MAX, resolution) == step) ) return LEVEL_MAX;
+   while ( low < high ) {
+      int mid = (low + high) / 2;
+      if ( outputStep(curve, mid, resolution) != step ) high = mid; else low = mid + 1;
+   }
+   return low;
+}
+
+level_t levelStepDown(const gammaCurve *curve, level_t level, unsigned int resolution) {
+   unsigned int step = outputStep(curve, level, resolution);
+   int low = 0;
+   int high = level - 1;
+
+   if ( (level <= 0) || (outputStep(curve, 0, resolution) == step) ) return 0;
+   while ( low < high ) {
+      int mid = (low + high + 1) / 2;
+      if ( outputStep(curve, mid, resolution) != step ) low = mid; else high = mid - 1;
+   }
+   return low;
+}
+
+bool writeFrame(fixtureTable &fixture, const level_t *levels, unsigned int resolution, OutputSet &output) {
+   for ( unsigned int c = 0; c < fixture.numChannels; c++ ) {
+      level_t level = levels[c];
+
+      // Sanity check
+      if ( level < 0 ) level = 0;
+
+      fixture.level[c] = level;
+      output.set(fixture.pin[c], levelToDuty(fixture.curve[c], level, resolution));
+   }
+   return output.flush();
+}
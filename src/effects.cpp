@@ -0,0 +1,145 @@
+#include <cmath>
+#include <ctime>
+
+#include <pthread.h>
+
+#include "effects.h"
+
+using namespace std;
+
+// Palettes used when an effect is given no colors
+static const uint8_t white[3] = { 255, 255, 255 };
+static const uint8_t candle[3] = { 255, 140, 40 };
+
+// Flicker never goes below this share of full brightness
+#define FLICKER_FLOOR 0.35
+
+static const char *effectNames[NUM_EFFECTS] = { "breathe", "rainbow", "flicker", "strobe" };
+
+bool effectValid(const effectParams &effect) {
+   return (effect.type < NUM_EFFECTS) && (effect.period >= EFFECT_MIN_PERIOD) && (effect.numColors <= EFFECT_MAX_COLORS);
+}
+
+const char *effectName(unsigned int type) {
+   return (type < NUM_EFFECTS) ? effectNames[type] : NULL;
+}
+
+uint32_t effectHash(uint32_t seed, uint32_t n) {
+   // The finalizer from MurmurHash3 over the seed and n combined
+   uint32_t h = seed ^ (n * 0x9e3779b9);
+   h ^= h >> 16;
+   h *= 0x85ebca6b;
+   h ^= h >> 13;
+   h *= 0xc2b2ae35;
+   h ^= h >> 16;
+   return h;
+}
+
+uint32_t fastRandom() {
+   static thread_local uint32_t state = 0;
+
+   if ( state == 0 ) {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      state = effectHash((uint32_t)ts.tv_nsec ^ (uint32_t)ts.tv_sec, (uint32_t)(uintptr_t)pthread_self());
+      if ( state == 0 ) state = 1;
+   }
+
+   // xorshift32
+   state ^= state << 13;
+   state ^= state >> 17;
+   state ^= state << 5;
+   return state;
+}
+
+// Palette color i, wrapping around, or fallback if there is no palette
+static const uint8_t *paletteColor(const effectParams &effect, uint32_t i, const uint8_t *fallback) {
+   if ( effect.numColors == 0 ) return fallback;
+   return effect.colors[i % effect.numColors];
+}
+
+// Set the output to a blend of two colors, scaled by level
+static void blend(const uint8_t *a, const uint8_t *b, double fraction, double level, double &red, double &green, double &blue) {
+   red = ((1.0 - fraction) * a[0] + fraction * b[0]) * level / 255.0;
+   green = ((1.0 - fraction) * a[1] + fraction * b[1]) * level / 255.0;
+   blue = ((1.0 - fraction) * a[2] + fraction * b[2]) * level / 255.0;
+}
+
+// Fully saturated color at hue between 0.0 and 1.0
+static void hueColor(double hue, double &red, double &green, double &blue) {
+   double h = hue * 6.0;
+   int sector = (int)h;
+   double f = h - sector;
+
+   switch ( sector % 6 ) {
+   case 0: red = 1.0;     green = f;       blue = 0.0;     break;
+   case 1: red = 1.0 - f; green = 1.0;     blue = 0.0;     break;
+   case 2: red = 0.0;     green = 1.0;     blue = f;       break;
+   case 3: red = 0.0;     green = 1.0 - f; blue = 1.0;     break;
+   case 4: red = f;       green = 0.0;     blue = 1.0;     break;
+   default: red = 1.0;    green = 0.0;     blue = 1.0 - f; break;
+   }
+}
+
+void effectColor(const effectParams &effect, uint64_t elapsed, double &red, double &green, double &blue) {
+   uint64_t period = (uint64_t)effect.period * 1000;
+   uint32_t cycle = (uint32_t)(elapsed / period);
+   double phase = (double)(elapsed % period) / (double)period;
+
+   switch ( effect.type ) {
+   case EFFECT_BREATHE: {
+      // Raised cosine: off at the start and end of each period, full on
+      // halfway, with the next palette color every breath
+      const uint8_t *color = paletteColor(effect, cycle, white);
+      blend(color, color, 0.0, (1.0 - cos(2.0 * M_PI * phase)) / 2.0, red, green, blue);
+      break;
+   }
+
+   case EFFECT_RAINBOW:
+      if ( effect.numColors == 0 ) {
+         hueColor(phase, red, green, blue);
+      } else {
+         double position = phase * effect.numColors;
+         uint32_t i = (uint32_t)position;
+         blend(effect.colors[i % effect.numColors], effect.colors[(i + 1) % effect.numColors], position - i, 1.0, red, green, blue);
+      }
+      break;
+
+   case EFFECT_FLICKER: {
+      // Value noise: a random brightness and color at every period,
+      // smoothly interpolated in between
+      uint32_t a = effectHash(effect.seed, cycle);
+      uint32_t b = effectHash(effect.seed, cycle + 1);
+      double levelA = FLICKER_FLOOR + (1.0 - FLICKER_FLOOR) * (a & 0xffff) / 65535.0;
+      double levelB = FLICKER_FLOOR + (1.0 - FLICKER_FLOOR) * (b & 0xffff) / 65535.0;
+      double smooth = phase * phase * (3.0 - 2.0 * phase);
+      blend(paletteColor(effect, a >> 16, candle), paletteColor(effect, b >> 16, candle), smooth,
+            levelA + (levelB - levelA) * smooth, red, green, blue);
+      break;
+   }
+
+   case EFFECT_STROBE:
+      if ( (elapsed % period) * 100 < period * STROBE_DUTY ) {
+         const uint8_t *color = paletteColor(effect, cycle, white);
+         blend(color, color, 0.0, 1.0, red, green, blue);
+      } else {
+         red = green = blue = 0.0;
+      }
+      break;
+
+   default:
+      red = green = blue = 0.0;
+      break;
+   }
+}
+
+uint64_t effectNextChange(const effectParams &effect, uint64_t elapsed) {
+   uint64_t period = (uint64_t)effect.period * 1000;
+   uint64_t cycleStart = elapsed - elapsed % period;
+   uint64_t onTime = period * STROBE_DUTY / 100;
+
+   // Only the strobe holds a color; it changes on its edges
+   if ( effect.type != EFFECT_STROBE ) return 0;
+   if ( elapsed - cycleStart < onTime ) return cycleStart + onTime;
+   return cycleStart + period;
+}
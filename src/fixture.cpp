@@ -0,0 +1,140 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "fixture.h"
+
+using namespace std;
+
+char roleName(unsigned char role) {
+   switch ( role ) {
+      case ROLE_RED: return 'r';
+      case ROLE_GREEN: return 'g';
+      case ROLE_BLUE: return 'b';
+      case ROLE_WHITE: return 'w';
+   }
+   return '?';
+}
+
+// Parse one "order:pin,pin,...[@curve]" group onto the end of the fixture
+static bool parseGroup(const string &spec, const string &defaultGamma, fixtureTable &fixture, string &error) {
+   size_t colon = spec.find(':');
+   size_t at = spec.find('@');
+   const gammaCurve *curve;
+   string order;
+   string pins;
+   size_t pos = 0;
+
+   if ( colon == string::npos ) {
+      error = "group '" + spec + "' is missing ':' between channel order and pins";
+      return false;
+   }
+   if ( fixture.numGroups >= MAX_GROUPS ) {
+      error = "too many groups";
+      return false;
+   }
+   if ( (at != string::npos) && (at < colon) ) {
+      error = "group '" + spec + "' has '@' before ':'";
+      return false;
+   }
+   order = spec.substr(0, colon);
+   if ( at == string::npos ) {
+      pins = spec.substr(colon + 1);
+      curve = loadGammaCurve(defaultGamma, error);
+   } else {
+      pins = spec.substr(colon + 1, at - colon - 1);
+      curve = loadGammaCurve(spec.substr(at + 1), error);
+   }
+   if ( curve == NULL ) return false;
+
+   for ( unsigned int i = 0; i < order.length(); i++ ) {
+      unsigned char role;
+      unsigned long pin;
+      char *end;
+
+      switch ( order[i] ) {
+         case 'r': role = ROLE_RED; break;
+         case 'g': role = ROLE_GREEN; break;
+         case 'b': role = ROLE_BLUE; break;
+         case 'w': role = ROLE_WHITE; break;
+         default:
+            error = string("unknown channel '") + order[i] + "' in group '" + spec + "'";
+            return false;
+      }
+
+      if ( pos >= pins.length() ) {
+         error = "group '" + spec + "' has fewer pins than channels";
+         return false;
+      }
+      pin = strtoul(pins.c_str() + pos, &end, 10);
+      if ( (end == pins.c_str() + pos) || (pin >= MAX_CHANNELS) ) {
+         error = "bad pin in group '" + spec + "'";
+         return false;
+      }
+      pos = end - pins.c_str();
+      if ( (pos < pins.length()) && (pins[pos] == ',') ) pos++;
+
+      for ( unsigned int c = 0; c < fixture.numChannels; c++ ) {
+         if ( fixture.pin[c] == pin ) {
+            error = "GPIO " + to_string(pin) + " is used more than once";
+            return false;
+         }
+      }
+      if ( fixture.numChannels >= MAX_CHANNELS ) {
+         error = "too many channels";
+         return false;
+      }
+
+      unsigned int c = fixture.numChannels++;
+      fixture.pin[c] = pin;
+      fixture.role[c] = role;
+      fixture.group[c] = fixture.numGroups;
+      fixture.curve[c] = curve;
+      fixture.level[c] = 0;
+      fixture.rampStart[c] = 0;
+      fixture.rampDelta[c] = 0;
+      fixture.rampTarget[c] = 0;
+      if ( role == ROLE_WHITE ) fixture.groupHasWhite[fixture.numGroups] = true;
+   }
+   if ( pos < pins.length() ) {
+      error = "group '" + spec + "' has more pins than channels";
+      return false;
+   }
+
+   fixture.numGroups++;
+   return true;
+}
+
+bool parseFixture(const string &spec, const string &defaultGamma, fixtureTable &fixture, string &error) {
+   size_t start = 0;
+
+   memset(&fixture, 0, sizeof(fixture));
+   while ( start <= spec.length() ) {
+      size_t slash = spec.find('/', start);
+      if ( slash == string::npos ) slash = spec.length();
+      if ( !parseGroup(spec.substr(start, slash - start), defaultGamma, fixture, error) ) return false;
+      start = slash + 1;
+   }
+   if ( fixture.numChannels == 0 ) {
+      error = "no channels";
+      return false;
+   }
+   return true;
+}
+
+void colorToLevels(const fixtureTable &fixture, double red, double green, double blue, level_t *levels) {
+   level_t color[3] = { levelFromDouble(red), levelFromDouble(green), levelFromDouble(blue) };
+   level_t white = color[0];
+
+   if ( color[1] < white ) white = color[1];
+   if ( color[2] < white ) white = color[2];
+
+   for ( unsigned int c = 0; c < fixture.numChannels; c++ ) {
+      if ( fixture.role[c] == ROLE_WHITE ) {
+         levels[c] = white;
+      } else if ( fixture.groupHasWhite[fixture.group[c]] ) {
+         levels[c] = color[fixture.role[c]] - white;
+      } else {
+         levels[c] = color[fixture.role[c]];
+      }
+   }
+}
@@ -0,0 +1,94 @@
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/timerfd.h>
+
+#include "frameclock.h"
+
+// The most descriptors waitUntil() will watch besides the timer itself
+#define MAX_WAIT_FDS 7
+
+FrameClock::FrameClock() : timerFd(-1), fps(0), period(0), armedDeadline(NO_DEADLINE) {
+   timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+   setFrameRate(DEFAULT_FRAME_RATE);
+}
+
+FrameClock::~FrameClock() {
+   if ( timerFd >= 0 ) close(timerFd);
+}
+
+uint64_t FrameClock::now() {
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+void FrameClock::setFrameRate(unsigned int newFps) {
+   if ( newFps == 0 ) newFps = DEFAULT_FRAME_RATE;
+   if ( newFps > 1000 ) newFps = 1000;
+   fps = newFps;
+   period = 1000000 / fps;
+}
+
+uint64_t FrameClock::nextFrame(uint64_t origin, uint64_t now) const {
+   if ( now < origin ) return origin;
+   return origin + (((now - origin) / period) + 1) * period;
+}
+
+uint64_t FrameClock::frameAtOrAfter(uint64_t origin, uint64_t time) const {
+   if ( time <= origin ) return origin;
+   return origin + (((time - origin) + period - 1) / period) * period;
+}
+
+void FrameClock::arm(uint64_t deadline) {
+   struct itimerspec its;
+
+   if ( deadline == armedDeadline ) return;
+   memset(&its, 0, sizeof(its));
+   if ( deadline != NO_DEADLINE ) {
+      // A zero it_value would disarm the timer, so never ask for time zero
+      if ( deadline == 0 ) deadline = 1;
+      its.it_value.tv_sec = deadline / 1000000;
+      its.it_value.tv_nsec = (deadline % 1000000) * 1000;
+   }
+   timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &its, NULL);
+   armedDeadline = deadline;
+}
+
+void FrameClock::acknowledge() {
+   uint64_t expirations;
+   ssize_t res = read(timerFd, &expirations, sizeof(expirations));
+   (void)res;
+   armedDeadline = NO_DEADLINE;
+}
+
+bool FrameClock::waitUntil(uint64_t deadline, struct pollfd *fds, unsigned int numFds) {
+   struct pollfd pfd[MAX_WAIT_FDS + 1];
+
+   if ( (deadline != NO_DEADLINE) && (now() >= deadline) ) return true;
+   if ( numFds > MAX_WAIT_FDS ) numFds = MAX_WAIT_FDS;
+
+   arm(deadline);
+   pfd[0].fd = timerFd;
+   pfd[0].events = POLLIN;
+   pfd[0].revents = 0;
+   for ( unsigned int i = 0; i < numFds; i++ ) {
+      pfd[i + 1] = fds[i];
+      pfd[i + 1].revents = 0;
+   }
+
+   // Go around again if we were interrupted by a signal
+   while ( (poll(pfd, numFds + 1, -1) < 0) && (errno == EINTR) ) {
+   }
+   for ( unsigned int i = 0; i < numFds; i++ ) {
+      fds[i].revents = pfd[i + 1].revents;
+   }
+
+   if ( pfd[0].revents & POLLIN ) {
+      acknowledge();
+      return true;
+   }
+   return false;
+}
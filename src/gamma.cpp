@@ -0,0 +1,51 @@
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include "gamma.h"
+
+using namespace std;
+
+// Every curve loaded so far. They live for the whole run.
+static vector<gammaCurve *> loadedCurves;
+
+// Inverse of CIE 1931 lightness: relative luminance for a lightness of x * 100
+static double cieLuminance(double x) {
+   double lightness = x * 100.0;
+   if ( lightness <= 8.0 ) return lightness / 903.3;
+   double t = (lightness + 16.0) / 116.0;
+   return t * t * t;
+}
+
+const gammaCurve *loadGammaCurve(const string &spec, string &error) {
+   double exponent = 0.0;
+   gammaCurve *curve;
+
+   for ( unsigned int i = 0; i < loadedCurves.size(); i++ ) {
+      if ( loadedCurves[i]->name == spec ) return loadedCurves[i];
+   }
+
+   if ( spec == "linear" ) {
+      exponent = 1.0;
+   } else if ( spec != "cie" ) {
+      char *end;
+      exponent = strtod(spec.c_str(), &end);
+      if ( spec.empty() || (*end != 0) || !(exponent > 0.0) || (exponent > 10.0) ) {
+         error = "unknown gamma curve '" + spec + "'";
+         return NULL;
+      }
+   }
+
+   curve = new gammaCurve;
+   curve->name = spec;
+   for ( unsigned int i = 0; i < GAMMA_ENTRIES; i++ ) {
+      double x = (double)(i << GAMMA_INDEX_SHIFT) / LEVEL_MAX;
+      double y;
+
+      if ( x > 1.0 ) x = 1.0;
+      y = (exponent > 0.0) ? pow(x, exponent) : cieLuminance(x);
+      curve->table[i] = (level_t)((y * LEVEL_MAX) + 0.5);
+   }
+   loadedCurves.push_back(curve);
+   return curve;
+}
@@ -0,0 +1,92 @@
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define INTERP_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define INTERP_NEON
+#endif
+
+#include "interp.h"
+
+level_t levelFromDouble(double level) {
+   if ( !(level > 0.0) ) return 0;
+   if ( level >= 1.0 ) return LEVEL_MAX;
+   return (level_t)((level * LEVEL_MAX) + 0.5);
+}
+
+int16_t rampFraction(uint64_t elapsed, uint64_t duration) {
+   if ( elapsed >= duration ) return FRACTION_ONE - 1;
+   return (int16_t)((elapsed << FRACTION_BITS) / duration);
+}
+
+uint64_t rampTimeToReach(level_t start, level_t delta, level_t level, uint64_t duration) {
+   uint64_t fraction;
+   int32_t distance;
+
+   if ( delta > 0 ) {
+      // Smallest fraction with (delta * fraction) >> 15 >= distance
+      distance = level - start;
+      if ( distance <= 0 ) return 0;
+      fraction = (((uint64_t)distance << FRACTION_BITS) + delta - 1) / delta;
+   } else if ( delta < 0 ) {
+      // The shift floors towards minus infinity, so going down we need
+      // (-delta * fraction) > (distance - 1) << 15
+      distance = start - level;
+      if ( distance <= 0 ) return 0;
+      fraction = (((uint64_t)(distance - 1) << FRACTION_BITS) / (uint64_t)(-delta)) + 1;
+   } else {
+      return duration;
+   }
+   if ( fraction >= FRACTION_ONE ) return duration;
+
+   // Smallest elapsed with (elapsed << 15) / duration >= fraction
+   return ((fraction * duration) + FRACTION_ONE - 1) >> FRACTION_BITS;
+}
+
+void interpolateScalar(const level_t *start, const level_t *delta, level_t *out, unsigned int n, int16_t fraction) {
+   for ( unsigned int i = 0; i < n; i++ ) {
+      int32_t product = (int32_t)delta[i] * fraction;
+      out[i] = (level_t)(start[i] + (product >> FRACTION_BITS));
+   }
+}
+
+void interpolateVector(const level_t *start, const level_t *delta, level_t *out, unsigned int n, int16_t fraction) {
+   unsigned int i = 0;
+
+#if defined(INTERP_SSE2)
+   // SSE2 has no 16x16->32 multiply into one register, so build the full
+   // products from the low and high halves, shift and narrow them again
+   __m128i f = _mm_set1_epi16(fraction);
+   for ( ; i + 8 <= n; i += 8 ) {
+      __m128i s = _mm_loadu_si128((const __m128i *)(start + i));
+      __m128i d = _mm_loadu_si128((const __m128i *)(delta + i));
+      __m128i lo = _mm_mullo_epi16(d, f);
+      __m128i hi = _mm_mulhi_epi16(d, f);
+      __m128i p0 = _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), FRACTION_BITS);
+      __m128i p1 = _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), FRACTION_BITS);
+      _mm_storeu_si128((__m128i *)(out + i), _mm_add_epi16(s, _mm_packs_epi32(p0, p1)));
+   }
+#elif defined(INTERP_NEON)
+   // vqdmulh gives (2 * d * f) >> 16, which is (d * f) >> 15 with the same
+   // flooring. It only saturates for -32768 * -32768, which can't happen
+   // since fraction is never negative.
+   int16x8_t f = vdupq_n_s16(fraction);
+   for ( ; i + 8 <= n; i += 8 ) {
+      int16x8_t s = vld1q_s16(start + i);
+      int16x8_t d = vld1q_s16(delta + i);
+      vst1q_s16(out + i, vaddq_s16(s, vqdmulhq_s16(d, f)));
+   }
+#endif
+
+   interpolateScalar(start + i, delta + i, out + i, n - i, fraction);
+}
+
+const char *interpolateVectorName() {
+#if defined(INTERP_SSE2)
+   return "SSE2";
+#elif defined(INTERP_NEON)
+   return "NEON";
+#else
+   return "none";
+#endif
+}
@@ -0,0 +1,159 @@
+#include "jitterbuffer.h"
+#include "frameclock.h"
+
+using namespace std;
+
+JitterBuffer::JitterBuffer() : started(false), delay((uint64_t)DEFAULT_JITTER_DELAY * 1000),
+   baseTimestamp(0), baseTime(0), nextSequence(0), lastTimestamp(0),
+   period(STREAM_DEFAULT_PERIOD), lastArrival(0), buffered(0), lastReceived(false), stalled(false),
+   depthShown(0), maxDepthShown(0), playedCount(0), lateCount(0), concealedCount(0), underrunCount(0) {
+   lastFrame.red = 0;
+   lastFrame.green = 0;
+   lastFrame.blue = 0;
+   for ( unsigned int i = 0; i < JITTER_SLOTS; i++ ) slots[i].used = false;
+}
+
+uint64_t JitterBuffer::dueAt(uint32_t timestamp) const {
+   // Signed, so a frame stamped just before the first one still works out
+   int64_t offset = (int64_t)(int32_t)(timestamp - baseTimestamp) * 1000;
+   int64_t due = (int64_t)baseTime + offset + (int64_t)delay;
+   return (due < 0) ? 0 : (uint64_t)due;
+}
+
+void JitterBuffer::start(uint32_t sequence, uint32_t timestamp, uint64_t now) {
+   for ( unsigned int i = 0; i < JITTER_SLOTS; i++ ) slots[i].used = false;
+   started = true;
+   baseTimestamp = timestamp;
+   baseTime = now;
+   nextSequence = sequence;
+   lastTimestamp = timestamp;
+   period = STREAM_DEFAULT_PERIOD;
+   buffered = 0;
+   lastReceived = false;
+   stalled = false;
+}
+
+void JitterBuffer::reset() {
+   for ( unsigned int i = 0; i < JITTER_SLOTS; i++ ) slots[i].used = false;
+   started = false;
+   buffered = 0;
+   depthShown = 0;
+}
+
+bool JitterBuffer::insert(uint32_t sequence, uint32_t timestamp, const streamFrame &frame, uint64_t now) {
+   lastArrival = now;
+   if ( !started ) {
+      start(sequence, timestamp, now);
+   } else {
+      int32_t ahead = (int32_t)(sequence - nextSequence);
+
+      // Far outside the window either way means the sender started over
+      if ( (ahead >= JITTER_SLOTS) || (ahead <= -JITTER_SLOTS) ) {
+         start(sequence, timestamp, now);
+      } else if ( ahead < 0 ) {
+         lateCount.fetch_add(1, memory_order_relaxed);
+         return false;
+      }
+   }
+
+   slot &s = slots[sequence % JITTER_SLOTS];
+   if ( s.used ) return false;
+   s.used = true;
+   s.sequence = sequence;
+   s.timestamp = timestamp;
+   s.frame = frame;
+   buffered++;
+   depthShown = buffered;
+   if ( buffered > maxDepthShown ) maxDepthShown = buffered;
+
+   // Arriving more than a frame earlier than the delay asks for means
+   // playout fell behind, e.g. after a stall. Move it forward.
+   uint64_t due = dueAt(timestamp);
+   if ( due > now + delay + period ) baseTime -= due - (now + delay);
+   return true;
+}
+
+void JitterBuffer::take(slot &s) {
+   uint64_t measured = (uint64_t)(uint32_t)(s.timestamp - lastTimestamp) * 1000;
+
+   // Only two frames received back to back tell us the frame rate
+   if ( lastReceived && (measured >= STREAM_MIN_PERIOD) && (measured <= STREAM_MAX_PERIOD) ) period = measured;
+   lastReceived = true;
+   stalled = false;
+   lastTimestamp = s.timestamp;
+   lastFrame = s.frame;
+   s.used = false;
+   buffered--;
+   depthShown = buffered;
+   nextSequence++;
+   playedCount.fetch_add(1, memory_order_relaxed);
+}
+
+int JitterBuffer::play(uint64_t now, streamFrame &frame) {
+   int result = STREAM_IDLE;
+
+   if ( !started ) return STREAM_IDLE;
+   while ( true ) {
+      slot &s = slots[nextSequence % JITTER_SLOTS];
+
+      // The next frame is here; play it once it is due. If we are behind,
+      // every frame that is due is taken and only the newest is shown.
+      if ( s.used && (s.sequence == nextSequence) ) {
+         if ( dueAt(s.timestamp) > now ) break;
+         take(s);
+         frame = lastFrame;
+         result = STREAM_FRAME;
+         continue;
+      }
+
+      // now is snapped to the frame deadline, so it can be a little
+      // earlier than the last arrival
+      if ( (buffered == 0) && (now > lastArrival) && (now - lastArrival >= STREAM_TIMEOUT) ) {
+         reset();
+         return STREAM_ENDED;
+      }
+      if ( dueAt(lastTimestamp) + period > now ) break;
+
+      // One frame missing with the one after it already here: show the
+      // midpoint in its place
+      slot &after = slots[(nextSequence + 1) % JITTER_SLOTS];
+      if ( after.used && (after.sequence == nextSequence + 1) ) {
+         lastFrame.red = (lastFrame.red + after.frame.red + 1) / 2;
+         lastFrame.green = (lastFrame.green + after.frame.green + 1) / 2;
+         lastFrame.blue = (lastFrame.blue + after.frame.blue + 1) / 2;
+         lastTimestamp += (uint32_t)(after.timestamp - lastTimestamp) / 2;
+         lastReceived = false;
+         nextSequence++;
+         concealedCount.fetch_add(1, memory_order_relaxed);
+         frame = lastFrame;
+         result = STREAM_CONCEALED;
+         continue;
+      }
+
+      // Several frames lost: skip to the next one we have
+      if ( buffered > 0 ) {
+         underrunCount.fetch_add(1, memory_order_relaxed);
+         while ( !slots[nextSequence % JITTER_SLOTS].used ) nextSequence++;
+         lastReceived = false;
+         continue;
+      }
+
+      // Nothing at all: hold the last frame and wait another period. A
+      // stream that has simply stopped stalls until it times out, so only
+      // running dry counts, not every period spent waiting.
+      if ( !stalled ) underrunCount.fetch_add(1, memory_order_relaxed);
+      stalled = true;
+      baseTime += period;
+      if ( result == STREAM_IDLE ) result = STREAM_UNDERRUN;
+      break;
+   }
+   return result;
+}
+
+uint64_t JitterBuffer::nextDue() const {
+   const slot &s = slots[nextSequence % JITTER_SLOTS];
+
+   if ( !started ) return NO_DEADLINE;
+   if ( s.used && (s.sequence == nextSequence) ) return dueAt(s.timestamp);
+   return dueAt(lastTimestamp) + period;
+}
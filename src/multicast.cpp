@@ -0,0 +1,85 @@
+#include <errno.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "multicast.h"
+#include "packet.h"
+
+using namespace std;
+
+in_addr_t multicastGroup(in_addr_t base, unsigned int id) {
+   return htonl(ntohl(base) + id);
+}
+
+bool parseMulticastBase(const string &spec, in_addr_t &base) {
+   struct in_addr addr;
+
+   if ( inet_pton(AF_INET, spec.c_str(), &addr) != 1 ) return false;
+   // 224.0.0.0/4, leaving room for all 64 IDs above the base
+   if ( !IN_MULTICAST(ntohl(addr.s_addr)) || !IN_MULTICAST(ntohl(addr.s_addr) + 64) ) return false;
+   base = addr.s_addr;
+   return true;
+}
+
+// Join or leave one group, returning false if the kernel refused
+static bool setGroup(int sock, in_addr_t group, in_addr_t iface, bool join) {
+   struct ip_mreq mreq;
+
+   memset(&mreq, 0, sizeof(mreq));
+   mreq.imr_multiaddr.s_addr = group;
+   mreq.imr_interface.s_addr = iface;
+   return setsockopt(sock, IPPROTO_IP, join ? IP_ADD_MEMBERSHIP : IP_DROP_MEMBERSHIP, &mreq, sizeof(mreq)) == 0;
+}
+
+unsigned int updateMulticastGroups(int sock, in_addr_t base, in_addr_t iface, uint64_t oldMembership, uint64_t newMembership, bool firstJoin, string &error) {
+   unsigned int joined = 0;
+   char address[INET_ADDRSTRLEN];
+
+   // Listening to every ID is the same as listening to the all group only
+   if ( oldMembership == TARGETS_ALL ) oldMembership = 0;
+   if ( newMembership == TARGETS_ALL ) newMembership = 0;
+
+   error.clear();
+   if ( firstJoin ) {
+      oldMembership = 0;
+#ifdef IP_MULTICAST_ALL
+      // Otherwise Linux hands us every group joined by any socket on the
+      // host bound to our port, such as another daemon's on loopback.
+      // Kernels without the option only ever deliver joined groups.
+      int all = 0;
+      setsockopt(sock, IPPROTO_IP, IP_MULTICAST_ALL, &all, sizeof(all));
+#endif
+   }
+
+   // The all group. Later calls join it again in case the first attempt
+   // failed; being a member already is fine.
+   in_addr_t allGroup = multicastGroup(base, 0);
+   if ( setGroup(sock, allGroup, iface, true) || (!firstJoin && (errno == EADDRINUSE)) ) {
+      joined = 1;
+   } else {
+      inet_ntop(AF_INET, &allGroup, address, sizeof(address));
+      error = string("unable to join ") + address + ": " + strerror(errno);
+      if ( firstJoin ) return 0;
+   }
+
+   for ( unsigned int id = 1; id <= 64; id++ ) {
+      uint64_t bit = (uint64_t)1 << (id - 1);
+      in_addr_t group = multicastGroup(base, id);
+
+      if ( (oldMembership & bit) && !(newMembership & bit) ) {
+         setGroup(sock, group, iface, false);
+      }
+      if ( (newMembership & bit) && !(oldMembership & bit) ) {
+         if ( !setGroup(sock, group, iface, true) ) {
+            if ( error.empty() ) {
+               inet_ntop(AF_INET, &group, address, sizeof(address));
+               error = string("unable to join ") + address + ": " + strerror(errno);
+            }
+            continue;
+         }
+      }
+      if ( newMembership & bit ) joined++;
+   }
+   return joined;
+}
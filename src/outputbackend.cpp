@@ -0,0 +1,98 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+
+#include "outputbackend.h"
+#include "outputwriter.h"
+#include "binaryoutput.h"
+#include "shmring.h"
+#include "frameclock.h"
+
+using namespace std;
+
+OutputSet::OutputSet() : numBackends(0) {
+   frame.time = 0;
+   frame.sequence = 0;
+   frame.changed = false;
+   frame.numPins = 0;
+   for ( unsigned int i = 0; i < OUTPUT_MAX_PINS; i++ ) slot[i] = -1;
+}
+
+bool OutputSet::add(OutputBackend *backend, const string &name) {
+   if ( numBackends >= OUTPUT_MAX_BACKENDS ) return false;
+   backends[numBackends] = backend;
+   names[numBackends] = name;
+   numBackends++;
+   return true;
+}
+
+void OutputSet::set(unsigned int pin, unsigned int duty) {
+   if ( pin >= OUTPUT_MAX_PINS ) return;
+   if ( duty > OUTPUT_DUTY_SCALE ) duty = OUTPUT_DUTY_SCALE;
+   if ( slot[pin] < 0 ) {
+      slot[pin] = frame.numPins++;
+      frame.pin[slot[pin]] = pin;
+      frame.changed = true;
+   } else if ( frame.duty[slot[pin]] != duty ) {
+      frame.changed = true;
+   }
+   frame.duty[slot[pin]] = duty;
+}
+
+bool OutputSet::flush() {
+   bool ok = true;
+
+   if ( frame.changed ) {
+      frame.time = FrameClock::now();
+      frame.sequence++;
+      if ( frame.sequence == 0 ) frame.sequence = 1;
+   }
+   for ( unsigned int i = 0; i < numBackends; i++ ) {
+      if ( !backends[i]->write(frame) ) ok = false;
+   }
+   frame.changed = false;
+   return ok;
+}
+
+bool OutputSet::pending() const {
+   for ( unsigned int i = 0; i < numBackends; i++ ) {
+      if ( backends[i]->pending() ) return true;
+   }
+   return false;
+}
+
+OutputBackend *openOutput(const string &spec, string &error) {
+   size_t colon = spec.find(':');
+   string kind = spec.substr(0, colon);
+   string path = (colon == string::npos) ? "" : spec.substr(colon + 1);
+   int fd;
+
+   if ( path.empty() ) {
+      error = "output '" + spec + "' has no path";
+      return NULL;
+   }
+
+   if ( kind == "shm" ) {
+      ShmRing *ring = new ShmRing();
+      if ( !ring->open(path, error) ) {
+         delete ring;
+         return NULL;
+      }
+      return ring;
+   }
+
+   if ( (kind != "text") && (kind != "binary") ) {
+      error = "unknown output '" + kind + "' (use text, binary or shm)";
+      return NULL;
+   }
+   fd = open(path.c_str(), O_WRONLY | O_CREAT | O_NONBLOCK | O_CLOEXEC, 0644);
+   if ( fd < 0 ) {
+      error = "unable to open " + path + ": " + strerror(errno);
+      return NULL;
+   }
+   if ( kind == "binary" ) return new BinaryOutput(fd);
+
+   OutputWriter *writer = new OutputWriter();
+   writer->setFd(fd);
+   return writer;
+}
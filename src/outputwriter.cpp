@@ -0,0 +1,129 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "outputwriter.h"
+#include "frameclock.h"
+
+OutputWriter::OutputWriter() : fd(-1), numPins(0), tailLength(0),
+      bytesCount(0), framesCount(0), droppedCount(0), partialCount(0), eagainCount(0), errorCount(0) {
+   for ( unsigned int i = 0; i < OUTPUT_MAX_PINS; i++ ) {
+      stagedDuty[i] = 0;
+      lastDuty[i] = OUTPUT_DUTY_SCALE + 1;
+      inUse[i] = false;
+   }
+}
+
+void OutputWriter::set(unsigned int pin, unsigned int duty) {
+   if ( pin >= OUTPUT_MAX_PINS ) return;
+   if ( duty > OUTPUT_DUTY_SCALE ) duty = OUTPUT_DUTY_SCALE;
+   if ( !inUse[pin] ) {
+      inUse[pin] = true;
+      pinOrder[numPins++] = pin;
+   }
+   stagedDuty[pin] = duty;
+}
+
+void OutputWriter::invalidate() {
+   for ( unsigned int i = 0; i < OUTPUT_MAX_PINS; i++ ) {
+      lastDuty[i] = OUTPUT_DUTY_SCALE + 1;
+   }
+}
+
+unsigned int OutputWriter::formatLine(char *out, unsigned int pin, unsigned int duty) {
+   char *p = out;
+
+   if ( pin >= 10 ) *p++ = '0' + (pin / 10);
+   *p++ = '0' + (pin % 10);
+   *p++ = '=';
+   if ( duty >= OUTPUT_DUTY_SCALE ) {
+      *p++ = '1';
+   } else {
+      *p++ = '0';
+      *p++ = '.';
+      p[3] = '0' + (duty % 10);
+      duty /= 10;
+      p[2] = '0' + (duty % 10);
+      duty /= 10;
+      p[1] = '0' + (duty % 10);
+      duty /= 10;
+      p[0] = '0' + duty;
+      p += 4;
+   }
+   *p++ = '\n';
+   return p - out;
+}
+
+bool OutputWriter::flush() {
+   unsigned int length = tailLength;
+   bool newLines;
+   ssize_t written;
+
+   // Append a line for every pin that changed after any unfinished tail
+   for ( unsigned int i = 0; i < numPins; i++ ) {
+      unsigned int pin = pinOrder[i];
+      if ( stagedDuty[pin] != lastDuty[pin] ) {
+         length += formatLine(buf + length, pin, stagedDuty[pin]);
+      }
+   }
+   if ( length == 0 ) return true;
+   newLines = (length > tailLength);
+
+   uint64_t start = FrameClock::now();
+   written = ::write(fd, buf, length);
+   writeTime.record((unsigned long)(FrameClock::now() - start));
+   if ( (written < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) ) {
+      // Not something a later frame gets past, so don't leave this one
+      // pending: what was staged counts as sent and the tail is given up
+      errorCount.fetch_add(1, std::memory_order_relaxed);
+      if ( newLines ) droppedCount.fetch_add(1, std::memory_order_relaxed);
+      for ( unsigned int i = 0; i < numPins; i++ ) {
+         unsigned int pin = pinOrder[i];
+         lastDuty[pin] = stagedDuty[pin];
+      }
+      tailLength = 0;
+      return false;
+   }
+   if ( written < 0 ) {
+      eagainCount.fetch_add(1, std::memory_order_relaxed);
+      written = 0;
+   } else {
+      bytesCount.fetch_add(written, std::memory_order_relaxed);
+   }
+
+   // If none of the new lines made it out this frame is dropped. Its pins
+   // stay staged (and differ from lastDuty) so the next frame resends them.
+   if ( (unsigned int)written <= tailLength ) {
+      memmove(buf, buf + written, tailLength - written);
+      tailLength -= written;
+      if ( newLines ) droppedCount.fetch_add(1, std::memory_order_relaxed);
+      return !newLines;
+   }
+
+   // The frame started going out, so it is committed. Anything left over is
+   // finished ahead of the next frame.
+   for ( unsigned int i = 0; i < numPins; i++ ) {
+      unsigned int pin = pinOrder[i];
+      lastDuty[pin] = stagedDuty[pin];
+   }
+   if ( (unsigned int)written < length ) {
+      partialCount.fetch_add(1, std::memory_order_relaxed);
+      memmove(buf, buf + written, length - written);
+   }
+   tailLength = length - written;
+   if ( newLines ) framesCount.fetch_add(1, std::memory_order_relaxed);
+   return true;
+}
+
+bool OutputWriter::pending() const {
+   if ( tailLength > 0 ) return true;
+   for ( unsigned int i = 0; i < numPins; i++ ) {
+      if ( stagedDuty[pinOrder[i]] != lastDuty[pinOrder[i]] ) return true;
+   }
+   return false;
+}
+
+bool OutputWriter::write(const outputFrame &frame) {
+   for ( unsigned int i = 0; i < frame.numPins; i++ ) set(frame.pin[i], frame.duty[i]);
+   return flush();
+}
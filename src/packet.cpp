@@ -0,0 +1,239 @@
+#include <cstdlib>
+
+#include "pwmcolors.h"
+#include "packet.h"
+
+using namespace std;
+
+// Decode the body of command cmd.command, which is bodyLength bytes at body
+static int parseBody(const unsigned char *body, size_t bodyLength, packetCommand &cmd) {
+   switch ( cmd.command ) {
+      case CMD_OFF:
+      case CMD_AUTODISABLE:
+      case CMD_QUERY:
+         return PARSE_OK;
+
+      case CMD_SETLEVELS:
+         if ( bodyLength < 7 ) return PARSE_TRUNCATED;
+         cmd.rampDuration = packetLoad32(body);
+         cmd.red = body[4];
+         cmd.green = body[5];
+         cmd.blue = body[6];
+         return PARSE_OK;
+
+      case CMD_STREAMFRAME:
+         if ( bodyLength < 11 ) return PARSE_TRUNCATED;
+         cmd.streamSequence = packetLoad32(body);
+         cmd.streamTimestamp = packetLoad32(body + 4);
+         cmd.red = body[8];
+         cmd.green = body[9];
+         cmd.blue = body[10];
+         return PARSE_OK;
+
+      case CMD_STOREPATTERN:
+         // The pattern ID followed by the same layout as CMD_AUTOPATTERN
+         if ( bodyLength < 1 ) return PARSE_TRUNCATED;
+         cmd.patternID = body[0];
+         body++;
+         bodyLength--;
+         // Fall through
+
+      case CMD_AUTOPATTERN:
+         if ( bodyLength < 5 ) return PARSE_TRUNCATED;
+         cmd.rampDuration = packetLoad32(body);
+         cmd.numColors = body[4];
+         if ( bodyLength - 5 < (size_t)cmd.numColors * PACKET_TRIPLET_SIZE ) return PARSE_TRUNCATED;
+         cmd.colors = body + 5;
+         return PARSE_OK;
+
+      case CMD_PLAYPATTERN:
+         if ( bodyLength < 1 ) return PARSE_TRUNCATED;
+         cmd.patternID = body[0];
+         return PARSE_OK;
+
+      case CMD_PATTERNCHUNK:
+         if ( bodyLength < PACKET_CHUNK_HEADER_SIZE ) return PARSE_TRUNCATED;
+         cmd.patternID = body[0];
+         cmd.chunkSequence = packetLoad16(body + 1);
+         cmd.chunkOffset = packetLoad16(body + 3);
+         cmd.chunkTotal = packetLoad16(body + 5);
+         cmd.rampDuration = packetLoad32(body + 7);
+         cmd.chunkEncoding = body[11];
+         cmd.chunkData = body + PACKET_CHUNK_HEADER_SIZE;
+         cmd.chunkLength = bodyLength - PACKET_CHUNK_HEADER_SIZE;
+         return PARSE_OK;
+
+      case CMD_SETTARGETS:
+         if ( bodyLength < 8 ) return PARSE_TRUNCATED;
+         cmd.membership = packetLoad64(body);
+         if ( cmd.membership == 0 ) cmd.membership = TARGETS_ALL;
+         return PARSE_OK;
+
+      case CMD_TIMESYNC:
+         if ( bodyLength < 8 ) return PARSE_TRUNCATED;
+         cmd.syncTime = packetLoad64(body);
+         return PARSE_OK;
+
+      case CMD_EFFECT:
+         if ( bodyLength < PACKET_EFFECT_HEADER_SIZE ) return PARSE_TRUNCATED;
+         cmd.effectType = body[0];
+         cmd.effectPeriod = packetLoad32(body + 1);
+         cmd.effectSeed = packetLoad32(body + 5);
+         cmd.numEffectColors = body[9];
+         if ( bodyLength - PACKET_EFFECT_HEADER_SIZE < (size_t)cmd.numEffectColors * PACKET_EFFECT_COLOR_SIZE ) return PARSE_TRUNCATED;
+         cmd.effectColors = body + PACKET_EFFECT_HEADER_SIZE;
+         return PARSE_OK;
+
+      case CMD_AT:
+         // A time to run at, then one of the commands that change what is
+         // shown with its own body. They don't nest.
+         if ( bodyLength < PACKET_AT_HEADER_SIZE ) return PARSE_TRUNCATED;
+         cmd.executeAt = packetLoad64(body);
+         cmd.command = body[8];
+         if ( (cmd.command != CMD_OFF) && (cmd.command != CMD_SETLEVELS) && (cmd.command != CMD_AUTOPATTERN) &&
+              (cmd.command != CMD_AUTODISABLE) && (cmd.command != CMD_PLAYPATTERN) && (cmd.command != CMD_EFFECT) ) {
+            return PARSE_UNKNOWN_CMD;
+         }
+         return parseBody(body + PACKET_AT_HEADER_SIZE, bodyLength - PACKET_AT_HEADER_SIZE, cmd);
+   }
+   return PARSE_UNKNOWN_CMD;
+}
+
+int parsePacket(const unsigned char *data, size_t length, packetCommand &cmd) {
+   // Fast path for stray broadcast traffic: one length check, one compare
+   if ( (length < 8) || (packetLoad64(data) != PACKET_MAGIC) ) return PARSE_BAD_MAGIC;
+   if ( length < PACKET_HEADER_SIZE ) return PARSE_TRUNCATED;
+
+   cmd.messageID = packetLoad32(data + 8);
+   cmd.command = data[12];
+   cmd.targets = packetLoad64(data + 13);
+   cmd.patternID = 0;
+   cmd.rampDuration = 0;
+   cmd.red = 0;
+   cmd.green = 0;
+   cmd.blue = 0;
+   cmd.membership = 0;
+   cmd.chunkSequence = 0;
+   cmd.chunkOffset = 0;
+   cmd.chunkTotal = 0;
+   cmd.chunkEncoding = 0;
+   cmd.chunkData = NULL;
+   cmd.chunkLength = 0;
+   cmd.streamSequence = 0;
+   cmd.streamTimestamp = 0;
+   cmd.executeAt = 0;
+   cmd.syncTime = 0;
+   cmd.effectType = 0;
+   cmd.effectPeriod = 0;
+   cmd.effectSeed = 0;
+   cmd.numEffectColors = 0;
+   cmd.effectColors = NULL;
+   cmd.numColors = 0;
+   cmd.colors = NULL;
+
+   return parseBody(data + PACKET_HEADER_SIZE, length - PACKET_HEADER_SIZE, cmd);
+}
+
+size_t buildPacketHeader(unsigned char *out, uint32_t messageID, uint8_t command, uint64_t targets) {
+   uint64_t magic = PACKET_MAGIC;
+
+   memcpy(out, &magic, 8);
+   memcpy(out + 8, &messageID, 4);
+   out[12] = command;
+   memcpy(out + 13, &targets, 8);
+   return PACKET_HEADER_SIZE;
+}
+
+bool parseTargetIDs(const string &spec, uint64_t &membership, string &error) {
+   size_t pos = 0;
+
+   membership = 0;
+   if ( spec.empty() || (spec == "0") ) {
+      membership = TARGETS_ALL;
+      return true;
+   }
+
+   while ( pos <= spec.size() ) {
+      size_t comma = spec.find(',', pos);
+      if ( comma == string::npos ) comma = spec.size();
+      string item = spec.substr(pos, comma - pos);
+      const char *p = item.c_str();
+      char *end;
+      long first, last;
+
+      first = strtol(p, &end, 10);
+      last = first;
+      if ( (end != p) && (*end == '-') ) {
+         p = end + 1;
+         last = strtol(p, &end, 10);
+         if ( end == p ) first = -1;
+      }
+      if ( item.empty() || (*end != 0) || (first < 1) || (last > 64) || (first > last) ) {
+         error = "invalid target ID '" + item + "' (IDs are 1 - 64)";
+         return false;
+      }
+      for ( long id = first; id <= last; id++ ) membership |= (uint64_t)1 << (id - 1);
+      pos = comma + 1;
+   }
+   return true;
+}
+
+string targetIDsToString(uint64_t membership) {
+   string result;
+
+   if ( membership == TARGETS_ALL ) return "all";
+   for ( unsigned int id = 1; id <= 64; id++ ) {
+      if ( !(membership & ((uint64_t)1 << (id - 1))) ) continue;
+      unsigned int last = id;
+      while ( (last < 64) && (membership & ((uint64_t)1 << last)) ) last++;
+      if ( !result.empty() ) result += ",";
+      result += to_string(id);
+      if ( last > id ) result += "-" + to_string(last);
+      id = last;
+   }
+   return result;
+}
+
+void commandFromPacket(const packetCommand &packet, colorCommand &cmd) {
+   cmd.command = packet.command;
+   cmd.patternID = packet.patternID;
+   cmd.rampDuration = packet.rampDuration;
+   cmd.numColors = 0;
+   cmd.executeAt = packet.executeAt;
+   cmd.syncTime = packet.syncTime;
+   cmd.streamSequence = packet.streamSequence;
+   cmd.streamTimestamp = packet.streamTimestamp;
+
+   if ( (packet.command == CMD_SETLEVELS) || (packet.command == CMD_STREAMFRAME) ) {
+      cmd.colors[0].red = packet.red / 255.0;
+      cmd.colors[0].green = packet.green / 255.0;
+      cmd.colors[0].blue = packet.blue / 255.0;
+      cmd.colors[0].restDuration = 0;
+      cmd.numColors = 1;
+   }
+
+   if ( (packet.command == CMD_AUTOPATTERN) || (packet.command == CMD_STOREPATTERN) ) {
+      uint8_t red, green, blue;
+      uint32_t restDuration;
+
+      // A command holds at most MAX_TRIPLETS so we limit it to that
+      cmd.numColors = (packet.numColors > MAX_TRIPLETS) ? MAX_TRIPLETS : packet.numColors;
+      for ( unsigned int i = 0; i < cmd.numColors; i++ ) {
+         packet.tripletAt(i, red, green, blue, restDuration);
+         cmd.colors[i].red = red / 255.0;
+         cmd.colors[i].green = green / 255.0;
+         cmd.colors[i].blue = blue / 255.0;
+         cmd.colors[i].restDuration = restDuration;
+      }
+   }
+
+   if ( packet.command == CMD_EFFECT ) {
+      cmd.effect.type = packet.effectType;
+      cmd.effect.period = packet.effectPeriod;
+      cmd.effect.seed = packet.effectSeed;
+      cmd.effect.numColors = (packet.numEffectColors > EFFECT_MAX_COLORS) ? EFFECT_MAX_COLORS : packet.numEffectColors;
+      for ( unsigned int i = 0; i < cmd.effect.numColors; i++ ) {
+         memcpy(cmd.effect.colors[i], packet.effectColors + i * PACKET_EFFECT_COLOR_SIZE, 3);
+      }
+   }
+}
@@ -0,0 +1,56 @@
+#include "patternstore.h"
+
+patternStep stepFromTriplet(const colorTriplet &color) {
+   patternStep step;
+   double levels[3] = { color.red, color.green, color.blue };
+   uint8_t bytes[3];
+
+   for ( unsigned int i = 0; i < 3; i++ ) {
+      double level = levels[i];
+      if ( level < 0.0 ) level = 0.0;
+      if ( level > 1.0 ) level = 1.0;
+      bytes[i] = (uint8_t)((level * 255.0) + 0.5);
+   }
+   step.red = bytes[0];
+   step.green = bytes[1];
+   step.blue = bytes[2];
+   step.restDuration = color.restDuration;
+   return step;
+}
+
+void copyPattern(storedPattern &to, const storedPattern &from) {
+   to.used = from.used;
+   to.rampDuration = from.rampDuration;
+   to.numColors = from.numColors;
+   for ( unsigned int i = 0; (i < from.numColors) && (i < PATTERN_MAX_STEPS); i++ ) to.colors[i] = from.colors[i];
+}
+
+PatternStore::PatternStore() : used(0) {
+   for ( unsigned int i = 0; i < PATTERN_SLOTS; i++ ) patterns[i].used = false;
+}
+
+bool PatternStore::store(unsigned int id, unsigned int rampDuration, const patternStep *steps, unsigned int numSteps) {
+   if ( (id >= PATTERN_SLOTS) || (numSteps == 0) ) return false;
+   if ( numSteps > PATTERN_MAX_STEPS ) numSteps = PATTERN_MAX_STEPS;
+
+   storedPattern &p = patterns[id];
+   if ( !p.used ) used++;
+   p.used = true;
+   p.rampDuration = rampDuration;
+   p.numColors = numSteps;
+   for ( unsigned int i = 0; i < numSteps; i++ ) p.colors[i] = steps[i];
+   return true;
+}
+
+bool PatternStore::store(unsigned int id, unsigned int rampDuration, const colorTriplet *colors, unsigned int numColors) {
+   patternStep steps[MAX_TRIPLETS];
+
+   if ( numColors > MAX_TRIPLETS ) numColors = MAX_TRIPLETS;
+   for ( unsigned int i = 0; i < numColors; i++ ) steps[i] = stepFromTriplet(colors[i]);
+   return store(id, rampDuration, steps, numColors);
+}
+
+const storedPattern *PatternStore::find(unsigned int id) const {
+   if ( (id >= PATTERN_SLOTS) || !patterns[id].used ) return 0;
+   return &patterns[id];
+}
@@ -0,0 +1,209 @@
+#include <string.h>
+
+#include "patternupload.h"
+
+int decodeChunkSteps(const unsigned char *data, size_t length, unsigned int encoding, patternStep *out, unsigned int maxSteps) {
+   unsigned int count = 0;
+   size_t pos = 0;
+
+   if ( encoding == CHUNK_RAW ) {
+      if ( (length % PACKET_TRIPLET_SIZE) != 0 ) return -1;
+      if ( (length / PACKET_TRIPLET_SIZE) > maxSteps ) return -1;
+      for ( ; pos < length; pos += PACKET_TRIPLET_SIZE ) {
+         out[count].red = data[pos];
+         out[count].green = data[pos + 1];
+         out[count].blue = data[pos + 2];
+         out[count].restDuration = packetLoad32(data + pos + 3);
+         count++;
+      }
+      return count;
+   }
+
+   if ( encoding != CHUNK_DELTA ) return -1;
+
+   while ( pos < length ) {
+      unsigned char op = data[pos++];
+
+      if ( op == CHUNK_OP_STEP ) {
+         if ( (length - pos < 7) || (count >= maxSteps) ) return -1;
+         out[count].red = data[pos];
+         out[count].green = data[pos + 1];
+         out[count].blue = data[pos + 2];
+         out[count].restDuration = packetLoad32(data + pos + 3);
+         count++;
+         pos += 7;
+         continue;
+      }
+
+      // Everything else builds on the step before
+      if ( (op != CHUNK_OP_DELTAS) && (op != CHUNK_OP_RUN) ) return -1;
+      if ( (count == 0) || (pos >= length) ) return -1;
+      unsigned int n = data[pos++];
+      if ( n > maxSteps - count ) return -1;
+      if ( length - pos < ((op == CHUNK_OP_RUN) ? 3 : (size_t)n * 3) ) return -1;
+
+      for ( unsigned int i = 0; i < n; i++ ) {
+         const unsigned char *delta = data + pos + ((op == CHUNK_OP_RUN) ? 0 : (i * 3));
+         const patternStep &before = out[count - 1];
+         int red = before.red + (int8_t)delta[0];
+         int green = before.green + (int8_t)delta[1];
+         int blue = before.blue + (int8_t)delta[2];
+         if ( (red < 0) || (red > 255) || (green < 0) || (green > 255) || (blue < 0) || (blue > 255) ) return -1;
+         out[count].red = red;
+         out[count].green = green;
+         out[count].blue = blue;
+         out[count].restDuration = before.restDuration;
+         count++;
+      }
+      pos += (op == CHUNK_OP_RUN) ? 3 : ((size_t)n * 3);
+   }
+   return count;
+}
+
+// The delta between two steps if it fits in signed bytes and the rest
+// time is unchanged
+static bool stepDelta(const patternStep &from, const patternStep &to, int8_t *delta) {
+   int d[3] = { to.red - from.red, to.green - from.green, to.blue - from.blue };
+
+   if ( to.restDuration != from.restDuration ) return false;
+   for ( unsigned int i = 0; i < 3; i++ ) {
+      if ( (d[i] < -128) || (d[i] > 127) ) return false;
+      delta[i] = (int8_t)d[i];
+   }
+   return true;
+}
+
+// How many steps from i on each add the same delta to the one before
+static unsigned int runLength(const patternStep *steps, unsigned int numSteps, unsigned int i) {
+   int8_t first[3];
+   int8_t next[3];
+   unsigned int run = 1;
+
+   if ( (i == 0) || !stepDelta(steps[i - 1], steps[i], first) ) return 0;
+   while ( (i + run < numSteps) && (run < 255) && stepDelta(steps[i + run - 1], steps[i + run], next) &&
+           (memcmp(next, first, 3) == 0) ) {
+      run++;
+   }
+   return run;
+}
+
+size_t encodeChunkSteps(const patternStep *steps, unsigned int numSteps, unsigned char *out, size_t outSize, unsigned int &consumed) {
+   size_t pos = 0;
+   unsigned int i = 0;
+
+   while ( i < numSteps ) {
+      int8_t delta[3];
+
+      // A chunk starts with a full step, as does any step too far from
+      // the one before
+      if ( (i == 0) || !stepDelta(steps[i - 1], steps[i], delta) ) {
+         if ( outSize - pos < 8 ) break;
+         out[pos] = CHUNK_OP_STEP;
+         out[pos + 1] = steps[i].red;
+         out[pos + 2] = steps[i].green;
+         out[pos + 3] = steps[i].blue;
+         memcpy(out + pos + 4, &steps[i].restDuration, 4);
+         pos += 8;
+         i++;
+         continue;
+      }
+
+      // Runs of the same delta, i.e. straight lines and holds
+      unsigned int run = runLength(steps, numSteps, i);
+      if ( run >= 3 ) {
+         if ( outSize - pos < 5 ) break;
+         out[pos] = CHUNK_OP_RUN;
+         out[pos + 1] = run;
+         memcpy(out + pos + 2, delta, 3);
+         pos += 5;
+         i += run;
+         continue;
+      }
+
+      // Otherwise as many individual deltas as fit
+      if ( outSize - pos < 5 ) break;
+      size_t countAt = pos + 1;
+      unsigned int n = 0;
+      out[pos] = CHUNK_OP_DELTAS;
+      pos += 2;
+      while ( (i < numSteps) && (n < 255) && (outSize - pos >= 3) && stepDelta(steps[i - 1], steps[i], delta) &&
+              ((n == 0) || (runLength(steps, numSteps, i) < 3)) ) {
+         memcpy(out + pos, delta, 3);
+         pos += 3;
+         n++;
+         i++;
+      }
+      out[countAt] = n;
+   }
+   consumed = i;
+   return pos;
+}
+
+PatternUpload::PatternUpload() : current(-1), haveFinished(false), finishedID(0), finishedSequence(0),
+                                 chunkCount(0), completedCount(0), rejectedCount(0) {
+   for ( unsigned int i = 0; i < UPLOAD_BUFFERS; i++ ) uploads[i].handedOver = false;
+}
+
+int PatternUpload::addChunk(const packetCommand &chunk) {
+   int decoded;
+
+   chunkCount++;
+   if ( (chunk.chunkTotal == 0) || (chunk.chunkTotal > PATTERN_MAX_STEPS) || (chunk.chunkOffset >= chunk.chunkTotal) ) {
+      rejectedCount++;
+      return -1;
+   }
+
+   // A late repeat of an upload we have already finished
+   if ( haveFinished && (chunk.patternID == finishedID) && (chunk.chunkSequence == finishedSequence) ) return -1;
+
+   // Start over if this chunk belongs to a different upload
+   if ( (current < 0) || (uploads[current].patternID != chunk.patternID) ||
+        (uploads[current].sequence != chunk.chunkSequence) || (uploads[current].total != chunk.chunkTotal) ) {
+      current = -1;
+      for ( int i = 0; i < UPLOAD_BUFFERS; i++ ) {
+         if ( !uploads[i].handedOver.load(std::memory_order_acquire) ) {
+            current = i;
+            break;
+         }
+      }
+      // Both buffers are still with the engine; the sender will repeat
+      if ( current < 0 ) {
+         rejectedCount++;
+         return -1;
+      }
+      upload &u = uploads[current];
+      u.patternID = chunk.patternID;
+      u.sequence = chunk.chunkSequence;
+      u.total = chunk.chunkTotal;
+      u.filled = 0;
+      memset(u.received, 0, sizeof(u.received));
+   }
+
+   upload &u = uploads[current];
+   u.rampDuration = chunk.rampDuration;
+   // Decode to the side first so a bad chunk can't spoil steps we already have
+   decoded = decodeChunkSteps(chunk.chunkData, chunk.chunkLength, chunk.chunkEncoding, scratch, u.total - chunk.chunkOffset);
+   if ( decoded < 0 ) {
+      rejectedCount++;
+      return -1;
+   }
+   for ( unsigned int i = chunk.chunkOffset; i < chunk.chunkOffset + (unsigned int)decoded; i++ ) {
+      uint64_t bit = (uint64_t)1 << (i % 64);
+      u.steps[i] = scratch[i - chunk.chunkOffset];
+      if ( !(u.received[i / 64] & bit) ) {
+         u.received[i / 64] |= bit;
+         u.filled++;
+      }
+   }
+
+   if ( u.filled < u.total ) return -1;
+
+   int finished = current;
+   u.handedOver.store(true, std::memory_order_relaxed);
+   haveFinished = true;
+   finishedID = u.patternID;
+   finishedSequence = u.sequence;
+   current = -1;
+   completedCount++;
+   return finished;
+}
@@ -3,9 +3,9 @@
 #include <string>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <chrono>
 #include <cmath>
-#include <vector>
 #include <typeinfo>
 #include <bitset>
 
@@ -17,60 +17,295 @@
 #include <signal.h>
 #include <ncurses.h>
 
+#include <poll.h>
+#include <errno.h>
+
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 
 #include <netinet/in.h>
-
-#define CMD_OFF         0x00
-#define CMD_SETLEVELS   0x01
-#define CMD_AUTOPATTERN 0x02
-#define CMD_AUTODISABLE 0x03
+#include <arpa/inet.h>
+
+#include "pwmcolors.h"
+#include "commandqueue.h"
+#include "frameclock.h"
+#include "outputwriter.h"
+#include "outputbackend.h"
+#include "fixture.h"
+#include "gamma.h"
+#include "dutymap.h"
+#include "packet.h"
+#include "replayfilter.h"
+#include "multicast.h"
+#include "patternstore.h"
+#include "statefile.h"
+#include "patternupload.h"
+#include "jitterbuffer.h"
+#include "timesync.h"
+#include "effects.h"
+#include "telemetry.h"
+#include "realtime.h"
 
 #define AUTO_DISABLED   0x00
 #define AUTO_ACTIVE     0x01
+#define AUTO_EFFECT     0x02
 
 #define NOPARAMETER "NOPARAMETER"
 
-// The GPIO pin numbers used for PWM (not the RPi connector pin numbers)
-#define GPIO_RED   23
-#define GPIO_GREEN 24
-#define GPIO_BLUE  25
-
 using namespace std;
 using namespace std::chrono;
 
-// Initial PWM/color values
-double redLevel = 0;
-double greenLevel = 0;
-double blueLevel = 0;
+// The attached channels and their levels. Only the render thread writes it.
+fixtureTable fixture;
+
+// Each channel's level as last written, in percent, for other threads
+atomic<unsigned int> shownLevel[MAX_CHANNELS];
+
+// The static color shown when no pattern is running. Only the render
+// thread touches these; other threads read the shown copies, in percent.
 double redStatic = 0;
 double greenStatic = 0;
 double blueStatic = 0;
+atomic<unsigned int> shownRedStatic(0);
+atomic<unsigned int> shownGreenStatic(0);
+atomic<unsigned int> shownBlueStatic(0);
+
+// Set the static color and the copies shown to other threads
+void setStaticLevels(double red, double green, double blue) {
+   redStatic = red;
+   greenStatic = green;
+   blueStatic = blue;
+   shownRedStatic = (unsigned int)(red * 100);
+   shownGreenStatic = (unsigned int)(green * 100);
+   shownBlueStatic = (unsigned int)(blue * 100);
+}
 
-// Variables for keeping the state of automatic color switching
-unsigned int autoMode = 0;
-bool autoActive = false;
-bool newCommand = false;
+// State of automatic color switching. Only the render thread writes it.
+atomic<unsigned int> autoMode(AUTO_DISABLED);
+
+// The pattern program currently being played by the render thread and
+// where in it we are. A new program is copied in here on handoff, so
+// replacing a stored pattern never disturbs the one that is playing.
+storedPattern activePattern;
+unsigned int patternIndex = 0;
+uint64_t patternStepEnd = 0;
+
+// The effect being played while autoMode is AUTO_EFFECT, and when it
+// started: in shared time if effectShared is set, otherwise on our clock.
+// Every frame is worked out from the time since then.
+effectParams activeEffect;
+uint64_t effectStart = 0;
+bool effectShared = false;
+
+// The ramp currently in progress. Levels are computed from the time elapsed
+// since startTime (monotonic microseconds), never by accumulating deltas.
+// The per channel start and target levels live in the fixture table.
+struct rampState {
+   bool active;
+   uint64_t startTime;
+   uint64_t duration;
+} ramp;
+
+// Paces frames on absolute deadlines. Only used by the render thread.
+FrameClock frameClock;
+
+// Offset between our clock and the controller's, from CMD_TIMESYNC
+// beacons. Only the render thread touches it.
+TimeSync timeSync;
+
+// Set while the active pattern runs on shared time. Its steps are then
+// laid out in the controller's clock, the next one starting at
+// patternSharedNext, and only converted to ours as each one starts.
+bool patternShared = false;
+uint64_t patternSharedNext = 0;
+
+// Commands sent with CMD_AT waiting for their time. Only the render
+// thread touches them.
+#define SCHEDULE_SLOTS 16
+colorCommand scheduledCommands[SCHEDULE_SLOTS];
+unsigned int numScheduled = 0;
+atomic<unsigned int> shownScheduled(0);
+atomic<unsigned long> scheduleDropped(0);
+
+// Microsecond timestamp of the pattern command waiting for its first frame,
+// and the measured queue-to-first-frame latencies of pattern switches
+uint64_t patternSwitchStart = 0;
+
+// Time from a command being received (or typed) to the first write that
+// shows it, and how late the engine woke up for each frame. Only the
+// render thread records them; writeWaitStart is the receive time of the
+// command whose first write is still to come.
+Histogram writeLatency;
+Histogram frameJitter;
+uint64_t writeWaitStart = 0;
+
+// When we started, for the uptime in telemetry snapshots
+uint64_t startTime = 0;
+atomic<unsigned int> lastSwitchLatency(0);
+atomic<unsigned int> maxSwitchLatency(0);
 
 // Initial delay in milliseconds between each color change while in an auto mode
 unsigned int crazyDelay = 250;
 
-// Struct for storing color/PWM value sets
-// Colors are obvious. restDuration is how long to rest on this color.
-struct colorTriplet {
-   double red;
-   double green;
-   double blue;
-   unsigned int restDuration;
+// Patterns uploaded by controllers and the keyboard presets. Only the
+// render thread touches it; other threads read the shown count.
+PatternStore patternStore;
+atomic<unsigned int> shownPatterns(0);
+
+// The keyboard presets, loaded into the pattern store at startup under
+// these IDs. Controllers can replace them like any other stored pattern.
+#define PRESET_CRAZY 0
+struct presetPattern {
+   char key;
+   unsigned char id;
+   unsigned int rampDuration;
+   unsigned char numColors;
+   colorTriplet colors[3];
 };
-
-unsigned int udpMsgCount = 0;
+const presetPattern presetPatterns[] = {
+   // only one element and all zero colors means set them randomly. The
+   // ramp is crazyDelay, set with '-' and '='.
+   { 'c', PRESET_CRAZY, 0, 1, { {0.0, 0.0, 0.0, 0} } },
+   { 'h', 1, 1000, 2, {
+      {1.0, 0.094, 0.0, 1000}, // orange
+      {0.0, 0.0, 0.0, 250}     // black
+   } },
+   { 'e', 2, 1000, 3, {
+      {1.0, 0.012, 0.753, 1000}, // pink
+      {0.031, 1.0, 0.969, 1000}, // cyan
+      {1.0, 0.988, 0.02, 1000}   // yellow
+   } },
+   { 'x', 3, 1000, 2, {
+      {1.0, 0.0, 0.0, 2000}, // red
+      {0.0, 1.0, 0.0, 2000}  // green
+   } },
+   { '4', 4, 1000, 3, {
+      {1.0, 0.0, 0.0, 1000}, // red
+      {0.5, 0.5, 0.5, 1000}, // white
+      {0.0, 0.0, 1.0, 1000}  // blue
+   } }
+};
+#define NUM_PRESETS (sizeof(presetPatterns) / sizeof(presetPatterns[0]))
+
+// The static levels, active pattern and pattern store as of the last
+// change, kept in an mmap'ed file so a restart comes back looking the same
+StateFile stateFile;
+
+// Commands waiting to be run by the render thread. Each queue has exactly
+// one producer: the UDP receiver and the keyboard thread respectively.
+CommandQueue<colorCommand, 16> udpQueue;
+CommandQueue<colorCommand, 16> keyQueue;
+
+// Datagrams taken off the socket, and those of them that were ours,
+// intact, new and for one of our IDs
+atomic<unsigned long> udpReceived(0);
+atomic<unsigned long> udpMsgCount(0);
+
+// Packets dropped by the receiver: not ours (no filter words) and ours but
+// malformed (truncated or an unknown command). Like the other receiver
+// counters only the receiving thread changes them.
+atomic<unsigned long> udpFiltered(0);
+atomic<unsigned long> udpMalformed(0);
+
+// Port we listen on, and the multicast groups we listen to on top of
+// broadcast and unicast. multicastEnabled is cleared by --multicast=off.
+unsigned int udpPort = DEFAULT_UDP_PORT;
+bool multicastEnabled = true;
+in_addr_t multicastBase;
+in_addr_t multicastInterface = INADDR_ANY;
+atomic<unsigned int> multicastGroups(0);
+
+// Duplicate suppression for UDP messages, per sender
+ReplayFilter replayFilter;
+
+// Reassembly of chunked pattern uploads. The receiver fills it and the
+// engine copies finished patterns out.
+PatternUpload patternUpload;
+
+// Frames streamed with CMD_STREAMFRAME waiting to be played. Only the
+// render thread touches it.
+JitterBuffer jitterBuffer;
+
+// Datagrams taken from the socket per recvmmsg() call, the largest datagram
+// kept whole, and the socket receive buffer asked for
+#define UDP_BATCH        32
+#define UDP_PACKET_SIZE  2048
+#define UDP_RCVBUF_SIZE  (1024 * 1024)
+
+// Level commands never queued because a newer one arrived in the same batch
+atomic<unsigned long> udpCoalesced(0);
 int pbDeviceFd = -1;
-unsigned int myTargetID = 0;
+
+// Formats and writes frames to pbDeviceFd. Only used by the render thread.
+OutputWriter output;
+
+// Every backend frames go to: output, then any given with --output. Only
+// used by the render thread.
+OutputSet outputs;
+
+// Number of distinct steps the PWM output can actually produce. Pi-Blaster
+// defaults to 1000 (a 10ms cycle sampled every 10us).
+unsigned int outputResolution = 1000;
+
+// Ramp frames that were never rendered because no channel's output step
+// would have changed
+atomic<unsigned long> framesSkipped(0);
+
+// Target IDs this node answers to, one bit per ID. Only the UDP thread
+// reads or changes it; the status screen gets a copy in two 32 bit halves
+// since 64 bit atomics aren't lock free on every Pi.
+uint64_t targetMembership = TARGETS_ALL;
+atomic<unsigned long> shownMembershipLow(0xffffffffUL);
+atomic<unsigned long> shownMembershipHigh(0xffffffffUL);
+
+void setTargetMembership(uint64_t membership) {
+   targetMembership = membership;
+   shownMembershipLow = (unsigned long)(membership & 0xffffffffUL);
+   shownMembershipHigh = (unsigned long)(membership >> 32);
+}
 
 // Boolean to indicate if we are in daemon mode or not
 bool daemonMode = false;
 
+// Run everything on one thread from a single epoll loop (--eventloop)
+bool eventLoopMode = false;
+
+// Real-time scheduling of the thread that renders frames (--rt, --cpu) and
+// how applying it went, for the status screen and telemetry. Set by main()
+// before the threads that read it are started.
+realtimeConfig realtime = { false, DEFAULT_RT_PRIORITY, -1 };
+bool memoryLocked = false;
+string realtimeStatus = "off";
+
+// Set by the render thread once it has applied --rt and --cpu, so main()
+// starts the threads that read realtimeStatus only after that
+atomic<bool> renderStarted(false);
+
+// Apply --rt and --cpu to the calling thread, the one that renders frames,
+// and note how that went. Failing to get real-time scheduling only costs
+// timing, so we carry on without it.
+void applyRealtime() {
+   string rtError;
+
+   if ( !realtime.enabled && (realtime.cpu < 0) ) return;
+   if ( enterRealtime(pthread_self(), realtime, rtError) ) {
+      realtimeStatus = realtimeDescription(realtime, memoryLocked);
+   } else {
+      realtimeStatus = "failed, " + rtError;
+      if ( daemonMode ) cout << "Warning: " << rtError << "\n";
+   }
+}
+
+// Cleared when the event loop should exit
+bool engineRunning = false;
+
+// Readable when SIGINT or SIGTERM arrives. Both are blocked in every thread.
+int signalFd = -1;
+
+// Most events taken from epoll per wakeup
+#define EVENTLOOP_MAX_EVENTS 8
+
 // Make oldSettings global so we can reset settings on a CTRL-C
 struct termios oldSettings;
 
@@ -84,14 +319,37 @@ void resetScreen() {
    cout << clear;
    cout << "PWM Shifter Running\n";
    cout << "-------------------\n";
-   cout << "Red   : " << (unsigned int)(redLevel * 100) << " (" << (unsigned int)(redStatic * 100) << ") %\n";
-   cout << "Green : " << (unsigned int)(greenLevel * 100) << " (" << (unsigned int)(greenStatic * 100) << ") %\n";
-   cout << "Blue  : " << (unsigned int)(blueLevel * 100) << " (" << (unsigned int)(blueStatic * 100) << ") %\n";
+   cout << "Static: Red " << shownRedStatic << " % Green " << shownGreenStatic << " % Blue " << shownBlueStatic << " %\n";
+   for ( unsigned int c = 0; c < fixture.numChannels; c++ ) {
+      cout << "GPIO " << (unsigned int)fixture.pin[c] << " (" << roleName(fixture.role[c]) << (unsigned int)fixture.group[c] << ") : " << shownLevel[c] << " %\n";
+   }
+   cout << "Stored patterns: " << shownPatterns << "/" << PATTERN_SLOTS << " (" << patternUpload.completed() << " uploads, " << patternUpload.chunks() << " chunks, " << patternUpload.rejected() << " rejected)\n";
    cout << "Crazy Speed : " << (crazyDelay/50) << "/20 (restart crazy to apply)\n";
    cout << "autoMode: " << autoMode << "\n";
-   cout << "autoActive: " << ((autoActive) ? "True" : "False") << "\n";
-   cout << "ID: " << myTargetID << "\n";
-   cout << "UDP Messages: " << udpMsgCount << "\n";
+   cout << "Pattern switch: " << lastSwitchLatency << " us (max " << maxSwitchLatency << " us)\n";
+   cout << "ID: " << targetIDsToString(((uint64_t)shownMembershipHigh << 32) | shownMembershipLow) << "\n";
+   if ( multicastEnabled ) {
+      char base[INET_ADDRSTRLEN];
+      inet_ntop(AF_INET, &multicastBase, base, sizeof(base));
+      cout << "Port: " << udpPort << ", multicast " << base << " (" << multicastGroups << " groups)\n";
+   } else {
+      cout << "Port: " << udpPort << ", broadcast only\n";
+   }
+   cout << "UDP Messages: " << udpMsgCount << " (" << udpQueue.dropped() << " dropped, " << udpFiltered << " filtered, " << udpMalformed << " malformed, " << replayFilter.duplicates() << " duplicate, " << udpCoalesced << " coalesced)\n";
+   cout << "Stream: depth " << jitterBuffer.depth() << " (max " << jitterBuffer.maxDepth() << ", delay " << (jitterBuffer.playoutDelay() / 1000) << " ms), " << jitterBuffer.played() << " played, " << jitterBuffer.late() << " late, " << jitterBuffer.concealed() << " concealed, " << jitterBuffer.underruns() << " underruns\n";
+   if ( timeSync.synced() ) {
+      cout << "Time sync: " << timeSync.beacons() << " beacons, last correction " << timeSync.lastCorrection() << " us, spread " << timeSync.spread() << " us";
+   } else {
+      cout << "Time sync: no beacons";
+   }
+   cout << ", " << shownScheduled << " scheduled (" << scheduleDropped << " dropped)\n";
+   cout << "Skipped frames: " << framesSkipped << " (resolution " << outputResolution << " steps)\n";
+   cout << "Latency: command to write " << writeLatency.percentile(50) << "/" << writeLatency.percentile(99) << " us, frame jitter " << frameJitter.percentile(50) << "/" << frameJitter.percentile(99) << " us, device write " << output.writeTimes().percentile(50) << "/" << output.writeTimes().percentile(99) << " us (p50/p99)\n";
+   cout << "Realtime: " << realtimeStatus << ", frame jitter max " << frameJitter.max() << " us\n";
+   cout << "Output: " << output.bytesWritten() << " bytes, " << output.framesWritten() << " frames (" << output.framesDropped() << " dropped, " << output.eagains() << " EAGAIN, " << output.writeErrors() << " errors)\n";
+   for ( unsigned int i = 1; i < outputs.count(); i++ ) {
+      cout << "Output " << outputs.name(i) << ": " << outputs.backend(i)->framesWritten() << " frames (" << outputs.backend(i)->framesDropped() << " dropped)\n";
+   }
    cout << "\n";
    cout << "Press 'R' or 'r' to increase/decrease static red intensity\n";
    cout << "Press 'G' or 'g' to increase/decrease static green intensity\n";
@@ -103,307 +361,944 @@ void resetScreen() {
    cout << "Press 'x' to get into the holiday spirit\n";
    cout << "Press '4' for an independance celebration\n";
    cout << "Press 'c' to GO CRAZY!!!! (epilepsy warning)\n";
+   cout << "Press 'w' for a slow rainbow\n";
+   cout << "Press 'f' to flicker like a candle\n";
    cout << "Press '-' or '=' to increase/decrease crazy speed\n";
    cout << "Press '.' to disable any auto-cycler\n";
    cout << "\n";
    cout << "Press 'q' to quit\n";
 }
 
-// pin is the GPIO number (not the RPi connector pin number)
-// level is a value between 0.0 and 1.0
-void setColor(unsigned int pin, double level) {
-   string cmd = "";
+// Monotonic time in microseconds, used to stamp commands as they are queued
+uint64_t nowMicros() {
+   return FrameClock::now();
+}
 
-   // Sanity check
-   level = abs(level);
-   if ( level > 1.0 ) level = 1.0;
+// True if a command is waiting for the render thread
+bool commandPending() {
+   return !udpQueue.empty() || !keyQueue.empty();
+}
+
+// Write one frame with a Q15 level for every channel, recording how long
+// the command that asked for it waited
+void setColors(const level_t *levels) {
+   writeFrame(fixture, levels, outputResolution, outputs);
+   for ( unsigned int c = 0; c < fixture.numChannels; c++ ) {
+      shownLevel[c].store((unsigned int)fixture.level[c] * 100 / LEVEL_MAX, memory_order_relaxed);
+   }
+   if ( writeWaitStart != 0 ) {
+      writeLatency.record((unsigned long)(FrameClock::now() - writeWaitStart));
+      writeWaitStart = 0;
+   }
+}
+
+// Note that a command received at queuedAt is waiting for its first write.
+// Commands run at a shared time were held back on purpose and aren't
+// counted.
+void awaitWrite(uint64_t queuedAt, uint64_t startAt) {
+   if ( (startAt == 0) && (writeWaitStart == 0) ) writeWaitStart = queuedAt;
+}
+
+// Write one frame with every channel set to the given RGB color
+void setColors(double red, double green, double blue) {
+   level_t levels[MAX_CHANNELS];
+
+   colorToLevels(fixture, red, green, blue, levels);
+   setColors(levels);
+}
 
-   // Set the appropriate global color level
-   if ( pin == GPIO_RED ) redLevel = level;
-   if ( pin == GPIO_GREEN ) greenLevel = level;
-   if ( pin == GPIO_BLUE ) blueLevel = level;
+// Start ramping every channel from its current level to the one for the
+// given color. colors are values between 0.0 and 1.0, duration is in
+// milliseconds and startTime is the monotonic microsecond the ramp is
+// considered to have begun at.
+void rampColors(double red, double green, double blue, unsigned int duration, uint64_t startTime) {
+   colorToLevels(fixture, red, green, blue, fixture.rampTarget);
+   for ( unsigned int c = 0; c < fixture.numChannels; c++ ) {
+      fixture.rampStart[c] = fixture.level[c];
+      fixture.rampDelta[c] = fixture.rampTarget[c] - fixture.level[c];
+   }
+   ramp.startTime = startTime;
+   ramp.duration = (uint64_t)duration * 1000;
+   ramp.active = true;
+}
 
-   // Create and write the output to the Pi-Blaster device for this color/pin
-   cmd = to_string(pin) + "=" + to_string(level) + "\n";
-   write(pbDeviceFd, cmd.c_str(), cmd.length());
+// The length of step i of the active pattern in microseconds. A step with
+// no ramp and no rest still takes one frame so we can't spin.
+uint64_t patternStepLength(unsigned int i) {
+   uint64_t length = ((uint64_t)activePattern.rampDuration + activePattern.colors[i].restDuration) * 1000;
+   if ( length < frameClock.framePeriod() ) length = frameClock.framePeriod();
+   return length;
 }
 
-// This function sleeps a thread for a specified duration.
-// However, it breaks that duration up into 5 millisecond
-// intervals so it can abort the full duration if a new
-// command has been received.
-void gentleSleep(unsigned int duration) {
-   unsigned int timeRemaining = duration;
-   unsigned int interval;
+// Begin the ramp for the current pattern step at stepStart. A pattern on
+// shared time ignores stepStart: its steps start on the controller's
+// clock, converted with the latest offset, so every node agrees on the
+// boundaries however fast its own clock runs.
+void startPatternStep(uint64_t stepStart) {
+   double red, green, blue;
+   uint64_t stepLength;
+
+   red = activePattern.colors[patternIndex].red / 255.0;
+   green = activePattern.colors[patternIndex].green / 255.0;
+   blue = activePattern.colors[patternIndex].blue / 255.0;
 
-   while ( !newCommand && (timeRemaining > 0) ) {
-      if ( timeRemaining > 5 ) {
-         interval = 5;
-         timeRemaining -= 5;
+   // If there is only one color triplet and all color values are zero, set the color randomly (i.e. Crazy mode)
+   if ( (activePattern.numColors == 1) && (red == 0.0) && (green == 0.0) && (blue == 0.0) ) {
+      red = (double)(fastRandom() % 500) / 1000.0;
+      green = (double)(fastRandom() % 500) / 1000.0;
+      blue = (double)(fastRandom() % 500) / 1000.0;
+   }
+   if ( patternShared ) stepStart = timeSync.toLocal(patternSharedNext);
+   rampColors(red, green, blue, activePattern.rampDuration, stepStart);
+
+   // Each step ends a fixed time after the previous one did, so the pattern
+   // never drifts no matter how late individual frames are
+   stepLength = patternStepLength(patternIndex);
+   patternStepEnd = stepStart + stepLength;
+   if ( patternShared ) {
+      patternSharedNext += stepLength;
+      patternStepEnd = timeSync.toLocal(patternSharedNext);
+   }
+}
+
+// Work out when the ramp next changes what the output actually shows and
+// return the first frame at or after that. Slow ramps wake up once per
+// output step instead of once per frame. Each channel moves to its next
+// step when it reaches the first level that quantizes differently.
+uint64_t nextRampFrame(uint64_t now) {
+   uint64_t end = ramp.startTime + ramp.duration;
+   uint64_t elapsed = now - ramp.startTime;
+   uint64_t change = ramp.duration;
+   uint64_t next;
+
+   for ( unsigned int c = 0; c < fixture.numChannels; c++ ) {
+      level_t delta = fixture.rampDelta[c];
+      level_t boundary;
+      uint64_t when;
+
+      if ( delta == 0 ) continue;
+      boundary = (delta > 0) ? levelStepUp(fixture.curve[c], fixture.level[c], outputResolution)
+                             : levelStepDown(fixture.curve[c], fixture.level[c], outputResolution);
+      when = rampTimeToReach(fixture.rampStart[c], delta, boundary, ramp.duration);
+      if ( when <= elapsed ) {
+         change = elapsed + 1;
+         break;
+      }
+      if ( when < change ) change = when;
+   }
+
+   next = frameClock.frameAtOrAfter(ramp.startTime, ramp.startTime + change);
+   if ( next <= now ) next = frameClock.nextFrame(ramp.startTime, now);
+   if ( next > end ) next = end;
+
+   // Count the frames on the grid between now and next that we never render
+   uint64_t frames = (next - now) / frameClock.framePeriod();
+   if ( frames > 1 ) framesSkipped.fetch_add(frames - 1, memory_order_relaxed);
+   return next;
+}
+
+// Write the frame for time now and return the absolute time the next frame
+// is due, or NO_DEADLINE if nothing is animating. Every level is computed
+// from the time elapsed since the ramp started, and the final frame of a
+// ramp writes the exact target, so ramps end on time and on value.
+uint64_t renderFrame(uint64_t now) {
+   level_t levels[MAX_CHANNELS];
+   uint64_t elapsed;
+
+   // A stream replaces patterns and ramps while it lasts. Its frames are
+   // shown as they fall due and nothing else is rendered in between.
+   if ( jitterBuffer.active() ) {
+      streamFrame frame;
+      int result = jitterBuffer.play(now, frame);
+      if ( (result == STREAM_FRAME) || (result == STREAM_CONCEALED) ) {
+         setColors(frame.red / 255.0, frame.green / 255.0, frame.blue / 255.0);
+      }
+      return jitterBuffer.nextDue();
+   }
+
+   // An effect is a function of time alone, so each frame is computed
+   // afresh. Effects on shared time are evaluated at the shared time, which
+   // keeps every node showing the same thing.
+   if ( autoMode == AUTO_EFFECT ) {
+      uint64_t origin = effectShared ? timeSync.toLocal(effectStart) : effectStart;
+      uint64_t change;
+      double red, green, blue;
+
+      elapsed = (now > origin) ? (now - origin) : 0;
+      effectColor(activeEffect, elapsed, red, green, blue);
+      setColors(red, green, blue);
+      if ( patternSwitchStart != 0 ) {
+         unsigned int latency = (unsigned int)(FrameClock::now() - patternSwitchStart);
+         lastSwitchLatency = latency;
+         if ( latency > maxSwitchLatency ) maxSwitchLatency = latency;
+         patternSwitchStart = 0;
+      }
+
+      // Effects that hold a color only need waking when it changes
+      change = effectNextChange(activeEffect, elapsed);
+      if ( change != 0 ) return origin + change;
+      return frameClock.nextFrame(origin, now);
+   }
+
+   // Catch up with any pattern steps that have finished since the last frame
+   if ( autoMode == AUTO_ACTIVE ) {
+      while ( now >= patternStepEnd ) {
+         // The finished step has reached its target even if we never got
+         // around to writing that frame, so the next ramp starts from there
+         if ( ramp.active ) {
+            for ( unsigned int c = 0; c < fixture.numChannels; c++ ) {
+               fixture.level[c] = fixture.rampTarget[c];
+            }
+            ramp.active = false;
+         }
+         patternIndex++;
+         if ( patternIndex >= activePattern.numColors ) patternIndex = 0;
+         startPatternStep(patternStepEnd);
+      }
+   }
+
+   if ( ramp.active ) {
+      elapsed = (now > ramp.startTime) ? (now - ramp.startTime) : 0;
+      if ( elapsed >= ramp.duration ) {
+         setColors(fixture.rampTarget);
+         ramp.active = false;
       } else {
-         interval = timeRemaining;
-         timeRemaining = 0;
+         // Interpolate every channel in one pass
+         interpolate(fixture.rampStart, fixture.rampDelta, levels, fixture.numChannels,
+                     rampFraction(elapsed, ramp.duration));
+         setColors(levels);
+      }
+
+      if ( patternSwitchStart != 0 ) {
+         unsigned int latency = (unsigned int)(FrameClock::now() - patternSwitchStart);
+         lastSwitchLatency = latency;
+         if ( latency > maxSwitchLatency ) maxSwitchLatency = latency;
+         patternSwitchStart = 0;
+      }
+
+      if ( ramp.active ) return nextRampFrame(now);
+   }
+
+   if ( autoMode == AUTO_ACTIVE ) return patternStepEnd;
+   return NO_DEADLINE;
+}
+
+// Start playing whatever program is in activePattern from its first step.
+// queuedAt is when the command asking for it was handed over. With a
+// shared startAt the pattern is a function of shared time: it counts as
+// having started then, so a node that hears the command late, or restarts,
+// joins at the step everybody else is on.
+void startActivePattern(uint64_t queuedAt, uint64_t startAt) {
+   patternIndex = 0;
+   patternShared = (startAt != 0);
+   if ( patternShared ) {
+      uint64_t now = timeSync.toShared(FrameClock::now());
+      uint64_t cycle = 0;
+
+      patternSharedNext = startAt;
+      for ( unsigned int i = 0; i < activePattern.numColors; i++ ) cycle += patternStepLength(i);
+      if ( (int64_t)(now - startAt) > 0 ) {
+         uint64_t into = (now - startAt) % cycle;
+         patternSharedNext = now - into;
+         while ( into >= patternStepLength(patternIndex) ) {
+            into -= patternStepLength(patternIndex);
+            patternSharedNext += patternStepLength(patternIndex);
+            patternIndex++;
+         }
       }
-      this_thread::sleep_for(chrono::milliseconds(interval));
    }
+   patternSwitchStart = queuedAt;
+   awaitWrite(queuedAt, startAt);
+   autoMode = AUTO_ACTIVE;
+   startPatternStep(FrameClock::now());
+   stateFile.saveActivePattern(true, &activePattern);
 }
 
-// colors are values between 0.0 and 1.0
-void setColors(double red, double green, double blue) {
-   string cmd = "";
-
-   // Sanity check
-   red = abs(red);
-   if ( red > 1.0 ) red = 1.0;
-   green = abs(green);
-   if ( green > 1.0 ) green = 1.0;
-   blue = abs(blue);
-   if ( blue > 1.0 ) blue = 1.0;
-
-   // Set the color level variables to the new levels
-   redLevel = red;
-   greenLevel = green;
-   blueLevel = blue;
-
-   // Create and write the output to the Pi-Blaster device for all colors/pins
-   cmd = to_string(GPIO_RED) + "=" + to_string(red) + "\n" + to_string(GPIO_GREEN) + "=" + to_string(green) + "\n" + to_string(GPIO_BLUE) + "=" + to_string(blue) + "\n";
-   write(pbDeviceFd, cmd.c_str(), cmd.length());
-}
-
-// colors are values between 0.0 and 1.0
-// duration is in milliseconds
-void rampColors(double red, double green, double blue, unsigned int duration) {
-   double redInterval, greenInterval, blueInterval;
-   double redNew, greenNew, blueNew;
-   unsigned int stepDuration = 5; // Number of milliseconds for each step.
-
-   // The number of steps is the duration divided by the duration of each step.
-   unsigned int steps = duration / stepDuration;
-
-   // Calculate the PWM level value for each step on each color independently.
-   // This scales the level difference for each step to be linear over the duration.
-   redInterval = (red - redLevel)/(double)steps;
-   greenInterval = (green - greenLevel)/(double)steps;
-   blueInterval = (blue - blueLevel)/(double)steps;
-
-   // Iterate over the steps
-   for ( int i = 0; i < steps; i++ ) {
-      // Increment each level interval
-      redNew = redLevel + redInterval;
-      greenNew = greenLevel + greenInterval;
-      blueNew = blueLevel + blueInterval;
-
-      // Set the output color/level and wait for stepDuration milliseconds
-      setColors(redNew, greenNew, blueNew);
-      gentleSleep(stepDuration);
-      if ( newCommand ) break;
-   }
-}
-
-// Pass in a vector of colorTriplet structs and an integer for how long to rest between color changes
-void autoCycleThread(vector<colorTriplet> colors, unsigned int rampDuration) {
-   double red, green, blue;
-   unsigned int currentIndex = 0;
+// Make a stored pattern the active one and start playing it, on shared
+// time if startAt isn't 0
+void playPattern(const storedPattern &pattern, uint64_t queuedAt, uint64_t startAt) {
+   if ( (pattern.numColors == 0) || (pattern.numColors > PATTERN_MAX_STEPS) ) return;
+   copyPattern(activePattern, pattern);
+   startActivePattern(queuedAt, startAt);
+}
+
+// Start playing effect. queuedAt is when the command asking for it was
+// handed over. With a shared startAt the effect counts as having started
+// then, so nodes that hear about it at different times still agree.
+void startEffect(const effectParams &effect, uint64_t queuedAt, uint64_t startAt) {
+   if ( !effectValid(effect) ) return;
+   activeEffect = effect;
+   effectShared = (startAt != 0);
+   effectStart = effectShared ? startAt : FrameClock::now();
+   ramp.active = false;
+   patternSwitchStart = queuedAt;
+   awaitWrite(queuedAt, startAt);
+   autoMode = AUTO_EFFECT;
+   stateFile.saveActiveEffect(activeEffect);
+}
 
-   autoActive = true;
-   while ( autoMode != AUTO_DISABLED ) {
-      red = colors.at(currentIndex).red;
-      green = colors.at(currentIndex).green;
-      blue = colors.at(currentIndex).blue;
+// Put the keyboard presets in the pattern store. Called before the
+// engine starts.
+void loadPresetPatterns() {
+   for ( unsigned int i = 0; i < NUM_PRESETS; i++ ) {
+      const presetPattern &preset = presetPatterns[i];
+      unsigned int rampDuration = (preset.id == PRESET_CRAZY) ? crazyDelay : preset.rampDuration;
+      patternStore.store(preset.id, rampDuration, preset.colors, preset.numColors);
+   }
+   shownPatterns = patternStore.count();
+}
+
+// Clamp a static level adjustment to the 0.0 - 1.0 range
+double adjustLevel(double level, double delta) {
+   level += delta;
+   if ( level > 1.0 ) level = 1.0;
+   if ( level < 0.0 ) level = 0.0;
+   return level;
+}
+
+// Bring back the state saved by a previous run: the pattern store, then
+// the pattern or effect that was playing or the static levels. Called before
+// the engine or the network start, so output is back straight away.
+void restoreState(const persistentState *state) {
+   setStaticLevels(adjustLevel(state->redStatic, 0.0), adjustLevel(state->greenStatic, 0.0), adjustLevel(state->blueStatic, 0.0));
 
-      // If there is only one color triplet and all color values are zero, set the color randomly (i.e. Crazy mode)
-      if ( (colors.size() == 1) && (red == 0.0) && (green == 0.0) && (blue == 0.0) ) {
-         red = (double)(rand() % 500) / 1000.0;
-         green = (double)(rand() % 500) / 1000.0;
-         blue = (double)(rand() % 500) / 1000.0;
+   for ( unsigned int id = 0; id < PATTERN_SLOTS; id++ ) {
+      const storedPattern &pattern = state->patterns[id];
+      if ( pattern.used && (pattern.numColors <= PATTERN_MAX_STEPS) ) {
+         patternStore.store(id, pattern.rampDuration, pattern.colors, pattern.numColors);
       }
-      rampColors(red, green, blue, rampDuration);
-      gentleSleep(colors.at(currentIndex).restDuration);
-      currentIndex++;
-      if ( currentIndex == colors.size() ) currentIndex = 0;
    }
+   shownPatterns = patternStore.count();
 
-   autoActive = false;
-   return;
+   if ( state->patternActive ) {
+      playPattern(state->activePattern, nowMicros(), 0);
+   } else if ( state->effectActive && effectValid(state->activeEffect) ) {
+      startEffect(state->activeEffect, nowMicros(), 0);
+   } else {
+      setColors(redStatic, greenStatic, blueStatic);
+   }
 }
 
-//
-// This function is run as a thread which listens for UDP messages
-// The message format is 16 bits for the command and 3x64 bits for
-// color values in the order RGB.
-void remoteColorThread() {
-   int sock, length, bytesReceived;
-   socklen_t fromlen;
+// Hold a command until its shared time comes round
+void scheduleCommand(const colorCommand &cmd) {
+   if ( numScheduled >= SCHEDULE_SLOTS ) {
+      scheduleDropped++;
+      return;
+   }
+   scheduledCommands[numScheduled++] = cmd;
+   shownScheduled = numScheduled;
+}
+
+// Run one decoded command. This is only ever called from the render thread,
+// which is the single consumer of both command queues. Nothing in here
+// waits; ramps and patterns are only set up and then played out by
+// renderFrame(). Returns false once the render thread should exit.
+bool executeCommand(const colorCommand &cmd) {
+   // A command for a shared time waits in the schedule until then. One that
+   // is already due starts as if it had run on time. Without beacons there
+   // is no shared time, so it just runs now.
+   uint64_t startAt = 0;
+   if ( (cmd.executeAt != 0) && timeSync.synced() ) {
+      if ( (int64_t)(timeSync.toLocal(cmd.executeAt) - FrameClock::now()) > 0 ) {
+         scheduleCommand(cmd);
+         return true;
+      }
+      startAt = cmd.executeAt;
+   }
+
+   if ( cmd.command == CMD_TIMESYNC ) {
+      timeSync.addBeacon(cmd.syncTime, cmd.queuedAt);
+   }
+
+   // Anything that sets the output itself ends a stream
+   if ( (cmd.command == CMD_SETLEVELS) || (cmd.command == CMD_OFF) || (cmd.command == CMD_AUTODISABLE) ||
+        (cmd.command == CMD_AUTOPATTERN) || (cmd.command == CMD_PLAYPATTERN) || (cmd.command == CMD_EFFECT) ||
+        (cmd.command == CMD_SHUTDOWN) ) {
+      jitterBuffer.reset();
+   }
+
+   // Stream frames go into the jitter buffer and renderFrame() plays them
+   // out. The first one stops whatever was running.
+   if ( cmd.command == CMD_STREAMFRAME ) {
+      streamFrame frame;
+      if ( !jitterBuffer.active() ) {
+         autoMode = AUTO_DISABLED;
+         ramp.active = false;
+         stateFile.saveActivePattern(false, NULL);
+      }
+      frame.red = (uint8_t)lround(cmd.colors[0].red * 255.0);
+      frame.green = (uint8_t)lround(cmd.colors[0].green * 255.0);
+      frame.blue = (uint8_t)lround(cmd.colors[0].blue * 255.0);
+      jitterBuffer.insert(cmd.streamSequence, cmd.streamTimestamp, frame, cmd.queuedAt);
+   }
+
+   // If we got a CMD_SETLEVELS ramp to the new values, ending any auto mode
+   if ( cmd.command == CMD_SETLEVELS ) {
+      autoMode = AUTO_DISABLED;
+      setStaticLevels(cmd.colors[0].red, cmd.colors[0].green, cmd.colors[0].blue);
+      awaitWrite(cmd.queuedAt, startAt);
+      rampColors(redStatic, greenStatic, blueStatic, cmd.rampDuration, (startAt != 0) ? timeSync.toLocal(startAt) : FrameClock::now());
+      stateFile.saveLevels(redStatic, greenStatic, blueStatic);
+      stateFile.saveActivePattern(false, NULL);
+   }
+
+   // If we got a CMD_OFF then turn off the auto cycler (if active) and set colors to 0 (zero)
+   if ( cmd.command == CMD_OFF ) {
+      autoMode = AUTO_DISABLED;
+      setStaticLevels(0.0, 0.0, 0.0);
+      ramp.active = false;
+      awaitWrite(cmd.queuedAt, startAt);
+      setColors(0.0, 0.0, 0.0);
+      stateFile.saveLevels(redStatic, greenStatic, blueStatic);
+      stateFile.saveActivePattern(false, NULL);
+   }
+
+   // If we got a CMD_AUTODISABLE then turn off the auto cycler
+   if ( cmd.command == CMD_AUTODISABLE ) {
+      autoMode = AUTO_DISABLED;
+      // Set everything back to the "static" values
+      awaitWrite(cmd.queuedAt, startAt);
+      rampColors(redStatic, greenStatic, blueStatic, 1000, FrameClock::now());
+      stateFile.saveActivePattern(false, NULL);
+   }
+
+   // If we got a CMD_AUTOPATTERN swap in the new program and start its
+   // first step. The next frame is rendered as soon as the queues are drained.
+   if ( cmd.command == CMD_AUTOPATTERN ) {
+      if ( (cmd.numColors > 0) && (cmd.numColors <= MAX_TRIPLETS) ) {
+         activePattern.used = true;
+         activePattern.rampDuration = cmd.rampDuration;
+         activePattern.numColors = cmd.numColors;
+         for ( unsigned int i = 0; i < cmd.numColors; i++ ) activePattern.colors[i] = stepFromTriplet(cmd.colors[i]);
+         startActivePattern(cmd.queuedAt, startAt);
+      }
+   }
+
+   // Stored patterns are already decoded, so playing one is just a copy
+   if ( cmd.command == CMD_STOREPATTERN ) {
+      if ( patternStore.store(cmd.patternID, cmd.rampDuration, cmd.colors, cmd.numColors) ) {
+         stateFile.savePattern(cmd.patternID, *patternStore.find(cmd.patternID));
+         shownPatterns = patternStore.count();
+      }
+   }
+   if ( cmd.command == CMD_STOREUPLOAD ) {
+      unsigned int id = patternUpload.patternID(cmd.uploadBuffer);
+      if ( patternStore.store(id, patternUpload.rampDuration(cmd.uploadBuffer), patternUpload.steps(cmd.uploadBuffer), patternUpload.numSteps(cmd.uploadBuffer)) ) {
+         stateFile.savePattern(id, *patternStore.find(id));
+         shownPatterns = patternStore.count();
+      }
+      patternUpload.release(cmd.uploadBuffer);
+   }
+   if ( cmd.command == CMD_PLAYPATTERN ) {
+      const storedPattern *pattern = patternStore.find(cmd.patternID);
+      if ( pattern != NULL ) {
+         playPattern(*pattern, cmd.queuedAt, startAt);
+      }
+   }
+
+   if ( cmd.command == CMD_EFFECT ) {
+      startEffect(cmd.effect, cmd.queuedAt, startAt);
+   }
+
+   // Keyboard nudge of the static levels. These only show up immediately
+   // when no pattern is running, and a running pattern keeps going.
+   if ( cmd.command == CMD_ADJUSTLEVELS ) {
+      setStaticLevels(adjustLevel(redStatic, cmd.colors[0].red), adjustLevel(greenStatic, cmd.colors[0].green), adjustLevel(blueStatic, cmd.colors[0].blue));
+      stateFile.saveLevels(redStatic, greenStatic, blueStatic);
+      if ( (autoMode == AUTO_DISABLED) && !jitterBuffer.active() ) {
+         ramp.active = false;
+         setColors(redStatic, greenStatic, blueStatic);
+      }
+   }
+
+   // Set all colors to zero and stop. The saved state is left alone so we
+   // come back the way we were.
+   if ( cmd.command == CMD_SHUTDOWN ) {
+      autoMode = AUTO_DISABLED;
+      ramp.active = false;
+      setColors(0.0, 0.0, 0.0);
+      return false;
+   }
+
+   return true;
+}
+
+// Run the scheduled commands that are due at time now, earliest first, and
+// return when the next one is
+uint64_t runScheduledCommands(uint64_t now) {
+   while ( numScheduled > 0 ) {
+      unsigned int first = 0;
+      for ( unsigned int i = 1; i < numScheduled; i++ ) {
+         if ( (int64_t)(scheduledCommands[i].executeAt - scheduledCommands[first].executeAt) < 0 ) first = i;
+      }
+      uint64_t due = timeSync.toLocal(scheduledCommands[first].executeAt);
+      if ( (int64_t)(due - now) > 0 ) return due;
+
+      colorCommand cmd = scheduledCommands[first];
+      scheduledCommands[first] = scheduledCommands[--numScheduled];
+      shownScheduled = numScheduled;
+      executeCommand(cmd);
+   }
+   return NO_DEADLINE;
+}
+
+// Do whatever is due at time now: scheduled commands first, then the frame.
+// Returns the absolute time something is next due, or NO_DEADLINE.
+uint64_t runEngine(uint64_t now) {
+   uint64_t scheduled, frame;
+
+   // Finish a frame the device couldn't take in full. Nothing else would
+   // once a ramp has ended, leaving the wrong level or half a line there.
+   if ( outputs.pending() ) outputs.flush();
+
+   scheduled = runScheduledCommands(now);
+   frame = renderFrame(now);
+   if ( scheduled < frame ) frame = scheduled;
+
+   // Keep trying once a frame until it is out
+   if ( outputs.pending() && (frame > now + frameClock.framePeriod()) ) frame = now + frameClock.framePeriod();
+   return frame;
+}
+
+// Hand a command to the engine. When the render thread is running it goes
+// through that thread's queue; in event loop mode the engine lives on the
+// calling thread, so the command is run on the spot.
+// Returns false if the queue was full and the command was dropped.
+bool deliverCommand(CommandQueue<colorCommand, 16> &queue, const colorCommand &cmd) {
+   if ( eventLoopMode ) {
+      if ( !executeCommand(cmd) ) engineRunning = false;
+      return true;
+   }
+   return queue.push(cmd);
+}
+
+// Block the signals we shut down on and return a descriptor which becomes
+// readable when one arrives. This is called before any thread starts so
+// every thread inherits the mask, and shutdown then happens as an ordinary
+// event on the thread that owns the output instead of in signal context.
+int openSignalFd() {
+   sigset_t mask;
+
+   sigemptyset(&mask);
+   sigaddset(&mask, SIGINT);
+   sigaddset(&mask, SIGTERM);
+   pthread_sigmask(SIG_BLOCK, &mask, NULL);
+   return signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+// Consume a pending signal and turn it into a shutdown command
+bool signalShutdown(colorCommand &cmd) {
+   struct signalfd_siginfo info;
+
+   if ( read(signalFd, &info, sizeof(info)) != sizeof(info) ) return false;
+   cmd.command = CMD_SHUTDOWN;
+   cmd.rampDuration = 0;
+   cmd.numColors = 0;
+   cmd.executeAt = 0;
+   cmd.queuedAt = nowMicros();
+   return true;
+}
+
+// This thread owns all channel state and is the one long lived pattern
+// engine. It sleeps on the frame clock, the queues' eventfds and the
+// signalfd, runs any handed over commands, then renders the frame that is
+// due, so neither a long ramp nor a pattern switch ever blocks the
+// receiver or keyboard.
+void renderThread() {
+   colorCommand cmd;
+   struct pollfd pfd[3];
+   bool running = true;
+   // Render once straight away in case a restored pattern is waiting
+   uint64_t deadline = 0;
+
+   // Scheduling and pinning first, so the stack is prefaulted (and the
+   // rest of the thread runs) on the right CPU under the right policy
+   applyRealtime();
+   if ( realtime.enabled ) prefaultStack();
+   renderStarted = true;
+
+   pfd[0].fd = udpQueue.notifyFd();
+   pfd[0].events = POLLIN;
+   pfd[1].fd = keyQueue.notifyFd();
+   pfd[1].events = POLLIN;
+   pfd[2].fd = signalFd;
+   pfd[2].events = POLLIN;
+
+   while ( running ) {
+      bool onTime = false;
+      pfd[2].revents = 0;
+      if ( !commandPending() ) {
+         onTime = frameClock.waitUntil(deadline, pfd, 3);
+      }
+      if ( (pfd[2].revents & POLLIN) && signalShutdown(cmd) ) {
+         executeCommand(cmd);
+         break;
+      }
+      udpQueue.clearNotify();
+      keyQueue.clearNotify();
+      while ( running && (keyQueue.pop(cmd) || udpQueue.pop(cmd)) ) {
+         running = executeCommand(cmd);
+      }
+      if ( !running ) break;
+
+      // A frame that is due is rendered for its scheduled time rather than
+      // the moment we woke up, unless we are more than a frame behind
+      uint64_t now = FrameClock::now();
+      if ( onTime && (deadline != 0) && (deadline != NO_DEADLINE) ) frameJitter.record((unsigned long)(now - deadline));
+      if ( onTime && (deadline != NO_DEADLINE) && ((now - deadline) < frameClock.framePeriod()) ) {
+         now = deadline;
+      }
+      deadline = runEngine(now);
+   }
+}
+
+// Convert a decoded packet to a command and hand it to the engine
+void queuePacket(const packetCommand &packet) {
+   colorCommand cmd;
+
+   commandFromPacket(packet, cmd);
+   cmd.queuedAt = nowMicros();
+   deliverCommand(udpQueue, cmd);
+}
+
+// Receive buffers for one batch. There is only ever one receiver.
+unsigned char udpBuffers[UDP_BATCH][UDP_PACKET_SIZE];
+struct iovec udpIovecs[UDP_BATCH];
+struct mmsghdr udpMsgs[UDP_BATCH];
+struct sockaddr_in udpSenders[UDP_BATCH];
+packetCommand udpPackets[UDP_BATCH];
+
+// Create and bind the listening UDP socket. Exits if that isn't possible.
+int openReceiveSocket() {
+   int sock, length;
+   int rcvbuf = UDP_RCVBUF_SIZE;
    struct sockaddr_in server;
-   struct sockaddr_in from;
-   char buf[1024] = {0};
-   unsigned int recvPort = 6565;
-   unsigned char redUDP, greenUDP, blueUDP;
-   unsigned int restDurationUDP;
-   unsigned char udpCommand;
-   string cmd = "";
-   unsigned int rampDuration;
-   vector<colorTriplet> colors;
-   struct colorTriplet color;
-   bool udpTarget = false;
-   unsigned long long targetBitField;
-   unsigned int lastMessageID = 0;
-   unsigned int curMessageID = 0;
-   unsigned int headerOffset = 13; // The number of bytes in the message header
-   
+   int reuse = 1;
+   string groupError;
+
+   for ( unsigned int i = 0; i < UDP_BATCH; i++ ) {
+      udpIovecs[i].iov_base = udpBuffers[i];
+      udpIovecs[i].iov_len = UDP_PACKET_SIZE;
+      memset(&udpMsgs[i], 0, sizeof(udpMsgs[i]));
+      udpMsgs[i].msg_hdr.msg_iov = &udpIovecs[i];
+      udpMsgs[i].msg_hdr.msg_iovlen = 1;
+      udpMsgs[i].msg_hdr.msg_name = &udpSenders[i];
+   }
 
    // Initialize the listening UDP socket.
-   sock = socket(AF_INET, SOCK_DGRAM, 0);
+   sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
    if ( sock < 0 ) {
        cout << "\nError creating receive socket\n";
        exit(1);
    }
+   // A bigger receive buffer rides out bursts while the render thread has
+   // the CPU. The kernel caps this at net.core.rmem_max, which is fine.
+   setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+   // Lets several daemons on one host (e.g. for testing over loopback)
+   // share the port. Each of them gets every broadcast, and the multicast
+   // groups it joined itself.
+   setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
    length = sizeof(server);
    memset(&server, 0, length);
    server.sin_family = AF_INET;
    server.sin_addr.s_addr = INADDR_ANY;
-   server.sin_port = htons(recvPort);
+   server.sin_port = htons(udpPort);
    if ( ::bind(sock,(struct sockaddr *)&server,length) < 0 ) {
        cout << "\nError binding to receive port\n";
        exit(1);
    }
-   fromlen = sizeof(struct sockaddr_in);
 
-   // Loop forever waiting for UDP messages
-   while ( true ) {
-      // Clear the input buffer and wait for a message
-      memset((char*)buf, 0, 1024);
-      bytesReceived = recvfrom(sock, buf, 1024, 0, (struct sockaddr *)&from, &fromlen);
+   // Join the groups for our IDs so traffic for other targets is dropped by
+   // the NIC and kernel. Broadcast still works if this fails.
+   if ( multicastEnabled ) {
+      multicastGroups = updateMulticastGroups(sock, multicastBase, multicastInterface, 0, targetMembership, true, groupError);
+      if ( !groupError.empty() && !daemonMode ) {
+         cout << "\nWarning: " << groupError << ", using broadcast only\n";
+      }
+   }
+   return sock;
+}
 
-      // Get the command from the first 8 bits of the UDP message
-      memcpy(&udpCommand, (char*)buf, 1);
+// The counters and histograms as one compact JSON object, called from the
+// receiving thread. It only reads atomics (counters, histograms and the
+// "shown" copies of engine state) and the output names and real-time
+// status, which are fixed before the receiver starts. Engine state such
+// as the static levels is never read directly.
+string telemetrySnapshot() {
+   string out;
+
+   out = "{\"ids\":\"" + targetIDsToString(((uint64_t)shownMembershipHigh << 32) | shownMembershipLow) + "\"";
+   out += ",\"uptime\":" + to_string((nowMicros() - startTime) / 1000000);
+   out += ",\"mode\":" + to_string(autoMode);
+   out += ",\"packets\":{\"received\":" + to_string(udpReceived) + ",\"accepted\":" + to_string(udpMsgCount);
+   out += ",\"filtered\":" + to_string(udpFiltered) + ",\"malformed\":" + to_string(udpMalformed);
+   out += ",\"duplicate\":" + to_string(replayFilter.duplicates()) + ",\"coalesced\":" + to_string(udpCoalesced);
+   out += ",\"queueDropped\":" + to_string(udpQueue.dropped()) + "}";
+   out += ",\"output\":{\"frames\":" + to_string(output.framesWritten()) + ",\"bytes\":" + to_string(output.bytesWritten());
+   out += ",\"dropped\":" + to_string(output.framesDropped()) + ",\"eagain\":" + to_string(output.eagains());
+   out += ",\"errors\":" + to_string(output.writeErrors());
+   out += ",\"skipped\":" + to_string(framesSkipped) + "}";
+   out += ",\"stream\":{\"played\":" + to_string(jitterBuffer.played()) + ",\"late\":" + to_string(jitterBuffer.late());
+   out += ",\"concealed\":" + to_string(jitterBuffer.concealed()) + ",\"underruns\":" + to_string(jitterBuffer.underruns()) + "}";
+   out += ",\"sync\":{\"beacons\":" + to_string(timeSync.beacons()) + ",\"spread\":" + to_string(timeSync.spread()) + "}";
+   out += ",\"writeLatency\":";
+   writeLatency.appendJSON(out);
+   out += ",\"frameJitter\":";
+   frameJitter.appendJSON(out);
+   out += ",\"deviceWrite\":";
+   output.writeTimes().appendJSON(out);
+   out += ",\"realtime\":\"" + realtimeStatus + "\"";
+   out += ",\"outputs\":[";
+   for ( unsigned int i = 1; i < outputs.count(); i++ ) {
+      if ( i > 1 ) out += ",";
+      out += "{\"name\":\"" + outputs.name(i) + "\",\"frames\":" + to_string(outputs.backend(i)->framesWritten());
+      out += ",\"dropped\":" + to_string(outputs.backend(i)->framesDropped()) + "}";
+   }
+   out += "]";
+   out += "}\n";
+   return out;
+}
 
-      // Get the target ID bitfield from bytes 2-9 of the UDP message
-      memcpy(&targetBitField, (char*)buf + 1, 8);
+// Add a chunk to the upload in progress, and once the upload is complete
+// hand the finished pattern to the engine to store
+void queueChunk(const packetCommand &packet) {
+   colorCommand cmd;
+   int buffer = patternUpload.addChunk(packet);
+
+   if ( buffer < 0 ) return;
+   cmd.command = CMD_STOREUPLOAD;
+   cmd.uploadBuffer = buffer;
+   cmd.rampDuration = 0;
+   cmd.numColors = 0;
+   cmd.executeAt = 0;
+   cmd.queuedAt = nowMicros();
+   // Nobody will ever copy it out if the queue is full, so free it now
+   if ( !deliverCommand(udpQueue, cmd) ) patternUpload.release(buffer);
+}
 
-      // Get the message ID. This is used to disregard repeat messages
-      // which may be sent to work around the "unreliable" in UDP
-      memcpy(&curMessageID, (char*)buf + 9, 4);
+//
+// Take one batch of up to UDP_BATCH datagrams off the socket and hand the
+// commands in it to the engine. Within a batch only the newest level
+// setting survives: a CMD_SETLEVELS followed by another CMD_SETLEVELS or a
+// CMD_OFF would be overwritten before it was ever seen, so it is counted
+// as coalesced and never delivered. flags is passed to recvmmsg().
+// Returns the number of datagrams received.
+int receiveBatch(int sock, int flags) {
+   int received;
+   int result;
+   bool accepted[UDP_BATCH];
+
+   for ( unsigned int i = 0; i < UDP_BATCH; i++ ) udpMsgs[i].msg_hdr.msg_namelen = sizeof(udpSenders[i]);
+   received = recvmmsg(sock, udpMsgs, UDP_BATCH, flags, NULL);
+   if ( received <= 0 ) return 0;
+   udpReceived.store(udpReceived.load(memory_order_relaxed) + received, memory_order_relaxed);
+
+   // First pass: validate, de-duplicate and filter in arrival order, and
+   // find the last command in the batch that sets the levels outright
+   int lastLevels = -1;
+   for ( int i = 0; i < received; i++ ) {
+      packetCommand &packet = udpPackets[i];
+      accepted[i] = false;
+
+      // Validate and decode only the bytes we actually received. Anything
+      // without our filter words is dropped after a single compare.
+      result = parsePacket(udpBuffers[i], udpMsgs[i].msg_len, packet);
+      if ( result != PARSE_OK ) {
+         if ( result == PARSE_BAD_MAGIC ) {
+            bumpCounter(udpFiltered);
+         } else {
+            bumpCounter(udpMalformed);
+         }
+         continue;
+      }
 
-      // Skip the rest of this packet if we've seen the exact same message before
-      if ( curMessageID == lastMessageID ) continue;
-      lastMessageID = curMessageID;
+      // Skip the rest of this packet if we've seen the exact same message
+      // before from this sender. The message ID is used to disregard repeat
+      // messages which may be sent to work around the "unreliable" in UDP.
+      // Stream frames are numbered by the stream itself and the jitter
+      // buffer drops repeats, so they don't take up the window.
+      if ( (packet.command != CMD_STREAMFRAME) && !replayFilter.accept(udpSenders[i].sin_addr.s_addr, udpSenders[i].sin_port, packet.messageID) ) continue;
 
       // The incoming target IDs are in a 64bit bitfield, one bit per ID
       // which provides 64 possible unique IDs and all zeros to indicate
-      // the message is intended for all targets. If myTargetID isn't set
-      // in the bitfield, and the bitfield isn't zero, skip this message.
-      if ( (myTargetID != 0) && (targetBitField != 0) && (((unsigned long long)pow(2, (myTargetID - 1)) & targetBitField) != (unsigned long long)pow(2, myTargetID - 1)) ) continue;
+      // the message is intended for all targets. Skip it unless it shares
+      // a bit with the IDs we answer to.
+      if ( !packetIsForUs(packet.targets, targetMembership) ) continue;
 
       // Only count messages intended for us
-      udpMsgCount++;
-
-      // If we got a CMD_SETLEVELS, do a sanity check on the data and
-      // ramp to the new values if we aren't currently in auto mode
-      if ( udpCommand == CMD_SETLEVELS ) {
-         newCommand = true;
-         memcpy(&rampDuration, (char*)buf + headerOffset, 4);
-         memcpy(&redUDP, (char*)buf + headerOffset + 4, 1);
-         memcpy(&greenUDP, (char*)buf + headerOffset + 5, 1);
-         memcpy(&blueUDP, (char*)buf + headerOffset + 6, 1);
-         if ( autoMode != AUTO_DISABLED ) {
-            autoMode = AUTO_DISABLED;
-            while ( autoActive ) {
-               this_thread::sleep_for(chrono::milliseconds(5));
-            }
-         }
-         redStatic = (double)(redUDP/255.0);
-         greenStatic = (double)(greenUDP/255.0);
-         blueStatic = (double)(blueUDP/255.0);
-         newCommand = false;
-         rampColors(redStatic, greenStatic, blueStatic, rampDuration);
-      }
-
-      // If we got a CMD_OFF then turn off the auto cycler (if active) and set colors to 0 (zero)
-      if ( udpCommand == CMD_OFF ) {
-         newCommand = true;
-         if ( autoMode != AUTO_DISABLED ) {
-            autoMode = AUTO_DISABLED;
-            while ( autoActive ) {
-               this_thread::sleep_for(chrono::milliseconds(5));
-            }
-         }
-         redStatic = 0.0;
-         greenStatic = 0.0;
-         blueStatic = 0.0;
-         newCommand = false;
-         setColors(0.0, 0.0, 0.0);
-      }
-
-      // If we got a CMD_AUTODISABLE then turn off the auto cycler
-      if ( udpCommand == CMD_AUTODISABLE ) {
-         newCommand = true;
-         if ( autoMode != AUTO_DISABLED ) {
-            autoMode = AUTO_DISABLED;
-            while ( autoActive ) {
-               this_thread::sleep_for(chrono::milliseconds(5));
-            }
-         }
-         newCommand = false;
-         // Set everything back to the "static" values
-         rampColors(redStatic, greenStatic, blueStatic, 1000);
-      }
-
-      // If we got a CMD_AUTOPATTERN then terminate any existing rotation
-      // and start a new one from the color sets provided
-      if ( udpCommand == CMD_AUTOPATTERN ) {
-         newCommand = true;
-         unsigned char numTriplets = 0;
-         memcpy(&rampDuration, (char*)buf + headerOffset, 4);
-         memcpy(&numTriplets, (char*)buf + headerOffset + 4, 1);
-         // The input buffer can hold a max of 35 full triplets plus the header so we limit it to that
-         if ( numTriplets > 35 ) numTriplets = 35;
-         colors.clear();
-         // Snag all the colors from the buffer
-         for ( unsigned int i = 0; i < numTriplets; i++ ) {
-            memcpy(&redUDP, (char*)buf + headerOffset + (5 + (i*7)), 1);
-            memcpy(&greenUDP, (char*)buf + headerOffset + (6 + (i*7)), 1);
-            memcpy(&blueUDP, (char*)buf + headerOffset + (7 + (i*7)), 1);
-            memcpy(&restDurationUDP, (char*)buf + headerOffset + (8 + (i*7)), 4);
-            color.red = (double)redUDP/255.0;
-            color.green = (double)greenUDP/255.0;
-            color.blue = (double)blueUDP/255.0;
-            color.restDuration = restDurationUDP;
-            // Sanity check the incoming color and restDuration data. Zero out color levels which are too high
-            colors.push_back(color);
-         }
-         // Wait for the current auto cycler to end if it is running
-         if ( autoMode != AUTO_DISABLED ) {
-            autoMode = AUTO_DISABLED;
-            while ( autoActive ) {
-               this_thread::sleep_for(chrono::milliseconds(5));
-            }
+      bumpCounter(udpMsgCount);
+
+      // Telemetry queries are answered straight from the receiver
+      if ( packet.command == CMD_QUERY ) {
+         string snapshot = telemetrySnapshot();
+         sendto(sock, snapshot.data(), snapshot.size(), 0, (struct sockaddr *)&udpSenders[i], sizeof(udpSenders[i]));
+         continue;
+      }
+
+      // Changing which IDs we answer to is handled right here since the
+      // receiver owns the filter, and it applies to the rest of the batch.
+      if ( packet.command == CMD_SETTARGETS ) {
+         if ( multicastEnabled ) {
+            string groupError;
+            multicastGroups = updateMulticastGroups(sock, multicastBase, multicastInterface, targetMembership, packet.membership, false, groupError);
          }
-         autoMode = AUTO_ACTIVE;
-         newCommand = false;
-         thread autoCycleT(autoCycleThread, colors, rampDuration);
-         autoCycleT.detach();
+         setTargetMembership(packet.membership);
+         continue;
       }
+
+      accepted[i] = true;
+      if ( ((packet.command == CMD_SETLEVELS) || (packet.command == CMD_OFF)) && (packet.executeAt == 0) ) lastLevels = i;
    }
+
+   // Second pass: hand the survivors to the engine in order
+   for ( int i = 0; i < received; i++ ) {
+      if ( !accepted[i] ) continue;
+      if ( udpPackets[i].command == CMD_PATTERNCHUNK ) {
+         queueChunk(udpPackets[i]);
+         continue;
+      }
+      if ( (udpPackets[i].command == CMD_SETLEVELS) && (udpPackets[i].executeAt == 0) && (i < lastLevels) ) {
+         bumpCounter(udpCoalesced);
+         continue;
+      }
+      queuePacket(udpPackets[i]);
+   }
+   return received;
 }
 
-// This thread monitors the keyboard for manual control of the levels and settings
-void keyPressThread() {
-   char keyPress = 0;
-   struct termios newSettings;
-   string cmd = "";
-   vector<colorTriplet> autoColors;
+//
+// This function is run as a thread which listens for UDP messages.
+// MSG_WAITFORONE blocks for the first datagram of each batch and then
+// takes whatever else is already waiting. Nothing in here waits on the
+// render thread, so the socket is read again right away even while a ramp
+// or auto pattern is running.
+void remoteColorThread() {
+   int sock = openReceiveSocket();
+
+   while ( true ) {
+      receiveBatch(sock, MSG_WAITFORONE);
+   }
+}
+
+// Hand a command from the keyboard thread to the render thread
+void queueKeyCommand(unsigned char command, double red, double green, double blue) {
+   colorCommand cmd;
+
+   cmd.command = command;
+   cmd.rampDuration = 0;
+   cmd.numColors = 1;
+   cmd.colors[0].red = red;
+   cmd.colors[0].green = green;
+   cmd.colors[0].blue = blue;
+   cmd.colors[0].restDuration = 0;
+   cmd.executeAt = 0;
+   cmd.queuedAt = nowMicros();
+   deliverCommand(keyQueue, cmd);
+}
+
+// Ask the render thread to play a stored pattern
+void queueKeyPlay(unsigned char patternID) {
+   colorCommand cmd;
+
+   cmd.command = CMD_PLAYPATTERN;
+   cmd.patternID = patternID;
+   cmd.rampDuration = 0;
+   cmd.numColors = 0;
+   cmd.executeAt = 0;
+   cmd.queuedAt = nowMicros();
+   deliverCommand(keyQueue, cmd);
+}
+
+// Ask the render thread to play an effect with its default palette
+void queueKeyEffect(unsigned char type, unsigned int period) {
+   colorCommand cmd;
+
+   cmd.command = CMD_EFFECT;
+   cmd.effect.type = type;
+   cmd.effect.period = period;
+   cmd.effect.seed = fastRandom();
+   cmd.effect.numColors = 0;
+   cmd.rampDuration = 0;
+   cmd.numColors = 0;
+   cmd.executeAt = 0;
+   cmd.queuedAt = nowMicros();
+   deliverCommand(keyQueue, cmd);
+}
+
+// Store the crazy preset again with the current crazy speed
+void queueKeyCrazySpeed() {
+   colorCommand cmd;
+
+   cmd.command = CMD_STOREPATTERN;
+   cmd.patternID = PRESET_CRAZY;
+   cmd.rampDuration = crazyDelay;
+   cmd.numColors = 1;
+   cmd.colors[0] = presetPatterns[0].colors[0];
+   cmd.executeAt = 0;
+   cmd.queuedAt = nowMicros();
+   deliverCommand(keyQueue, cmd);
+}
 
-   // Set the values to zero on startup
-   setColors(0.0, 0.0, 0.0);
+// Switch the terminal to unbuffered, no-echo input
+void startKeyboard() {
+   struct termios newSettings;
 
    // Store the current stdin settings and change to no-echo/no-return
    tcgetattr(fileno(stdin), &oldSettings);
    newSettings = oldSettings;
    newSettings.c_lflag &= (~ICANON & ~ECHO);
    tcsetattr(fileno(stdin), TCSANOW, &newSettings);
+}
 
-   while ( keyPress != 'q' ) {
+// Act on one key press. Returns false once the user has asked to quit.
+bool handleKey(char keyPress) {
+   // Perform the appropriate actions based on which key was pressed.
+   // Level changes are applied by the engine, which owns them.
+   if ( keyPress == 'R' ) queueKeyCommand(CMD_ADJUSTLEVELS, 0.1, 0.0, 0.0);
+   if ( keyPress == 'r' ) queueKeyCommand(CMD_ADJUSTLEVELS, -0.1, 0.0, 0.0);
+   if ( keyPress == 'G' ) queueKeyCommand(CMD_ADJUSTLEVELS, 0.0, 0.1, 0.0);
+   if ( keyPress == 'g' ) queueKeyCommand(CMD_ADJUSTLEVELS, 0.0, -0.1, 0.0);
+   if ( keyPress == 'B' ) queueKeyCommand(CMD_ADJUSTLEVELS, 0.0, 0.0, 0.1);
+   if ( keyPress == 'b' ) queueKeyCommand(CMD_ADJUSTLEVELS, 0.0, 0.0, -0.1);
+   if ( keyPress == '[' ) queueKeyCommand(CMD_ADJUSTLEVELS, 0.1, 0.1, 0.1);
+   if ( keyPress == ']' ) queueKeyCommand(CMD_ADJUSTLEVELS, -0.1, -0.1, -0.1);
+   if ( keyPress == '-' ) {
+      if ( (crazyDelay - 50) >= 50 ) {
+         crazyDelay -= 50;
+         queueKeyCrazySpeed();
+      }
+   }
+   if ( keyPress == '=' ) {
+      if ( (crazyDelay + 50) <= 1000 ) {
+         crazyDelay += 50;
+         queueKeyCrazySpeed();
+      }
+   }
+   // The presets are played from the pattern store
+   for ( unsigned int i = 0; i < NUM_PRESETS; i++ ) {
+      if ( keyPress == presetPatterns[i].key ) queueKeyPlay(presetPatterns[i].id);
+   }
+   if ( keyPress == 'w' ) queueKeyEffect(EFFECT_RAINBOW, 10000);
+   if ( keyPress == 'f' ) queueKeyEffect(EFFECT_FLICKER, 120);
+   if ( keyPress == '.' ) {
+      if ( autoMode != AUTO_DISABLED ) {
+         queueKeyCommand(CMD_AUTODISABLE, 0.0, 0.0, 0.0);
+      }
+   }
+   if ( keyPress == 'q' ) {
+      // The engine sets all colors to zero on its way out
+      queueKeyCommand(CMD_SHUTDOWN, 0.0, 0.0, 0.0);
+      return false;
+   }
+   return true;
+}
+
+// This thread monitors the keyboard for manual control of the levels and settings
+void keyPressThread() {
+   char keyPress = 0;
+   bool running = true;
+
+   while ( running ) {
       // Set up the keyPress waiting logic. The keyPress loop will use
       // select to wait for the specified interval then continue through
       // the loop. This allows us to update the screen periodically even
@@ -419,191 +1314,104 @@ void keyPressThread() {
       int res = select(fileno(stdin)+1, &set, NULL, NULL, &tv);
       if ( res > 0 ) {
          read(fileno(stdin), &keyPress, 1);
-      } else {
-         keyPress = 0;
-      }
-
-      // Perform the appropriate actions based on which key was pressed
-      if ( (keyPress == 'R') && (redStatic < 1.0) ) {
-         redStatic += 0.1;
-         if ( redStatic > 1.0 ) redStatic = 1.0;
-         if ( autoMode == AUTO_DISABLED ) setColor(GPIO_RED, redStatic);
-      }
-      if ( (keyPress == 'r') && (redStatic > 0.0) ) {
-         redStatic -= 0.1;
-         if ( redStatic < 0.0 ) redStatic = 0.0;
-         if ( autoMode == AUTO_DISABLED ) setColor(GPIO_RED, redStatic);
-      }
-      if ( (keyPress == 'G') && (greenStatic < 1.0) ) {
-         greenStatic += 0.1;
-         if ( greenStatic > 1.0 ) greenStatic = 1.0;
-         if ( autoMode == AUTO_DISABLED ) setColor(GPIO_GREEN, greenStatic);
-      }
-      if ( (keyPress == 'g') && (greenStatic > 0.0) ) {
-         greenStatic -= 0.1;
-         if ( greenStatic < 0.0 ) greenStatic = 0.0;
-         if ( autoMode == AUTO_DISABLED ) setColor(GPIO_GREEN, greenStatic);
-      }
-      if ( (keyPress == 'B') && (blueStatic < 1.0) ) {
-         blueStatic += 0.1;
-         if ( blueStatic > 1.0 ) blueStatic = 1.0;
-         if ( autoMode == AUTO_DISABLED ) setColor(GPIO_BLUE, blueStatic);
-      }
-      if ( (keyPress == 'b') && (blueStatic > 0.0) ) {
-         blueStatic -= 0.1;
-         if ( blueStatic < 0.0 ) blueStatic = 0.0;
-         if ( autoMode == AUTO_DISABLED ) setColor(GPIO_BLUE, blueStatic);
-      }
-      if ( keyPress == '[' ) {
-         if ( redStatic < 1.0 ) {
-            redStatic += 0.1;
-         }
-         if ( greenStatic < 1.0 ) {
-            greenStatic += 0.1;
-         }
-         if ( blueStatic < 1.0 ) {
-            blueStatic += 0.1;
-         }
-         if ( redStatic > 1.0 ) redStatic = 1.0;
-         if ( greenStatic > 1.0 ) greenStatic = 1.0;
-         if ( blueStatic > 1.0 ) blueStatic = 1.0;
-         if ( autoMode == AUTO_DISABLED ) setColors(redStatic, greenStatic, blueStatic);
-      }
-      if ( keyPress == ']' ) {
-         if ( redStatic > 0.0 ) {
-            redStatic -= 0.1;
-         }
-         if ( greenStatic > 0.0 ) {
-            greenStatic -= 0.1;
-         }
-         if ( blueStatic > 0.0 ) {
-            blueStatic -= 0.1;
-         }
-         if ( redStatic < 0.0 ) redStatic = 0.0;
-         if ( greenStatic < 0.0 ) greenStatic = 0.0;
-         if ( blueStatic < 0.0 ) blueStatic = 0.0;
-         if ( autoMode == AUTO_DISABLED ) setColors(redStatic, greenStatic, blueStatic);
-      }
-      if ( keyPress == '-' ) {
-         if ( (crazyDelay - 50) >= 50 ) {
-            crazyDelay -= 50;
-         }
+         running = handleKey(keyPress);
       }
-      if ( keyPress == '=' ) {
-         if ( (crazyDelay + 50) <= 1000 ) {
-            crazyDelay += 50;
-         }
+      resetScreen();
+   }
+}
+
+//
+// Single threaded alternative to the render, receive and keyboard threads.
+// One epoll set watches the UDP socket, stdin, the frame clock's timerfd
+// and the signalfd, and the engine runs directly on this thread. With no
+// ramp or pattern running the timer is disarmed, so an idle process never
+// wakes up.
+//
+void eventLoop() {
+   struct epoll_event ev;
+   struct epoll_event events[EVENTLOOP_MAX_EVENTS];
+   int epollFd;
+   int sock;
+   // Render once straight away in case a restored pattern is waiting
+   uint64_t deadline = 0;
+   uint64_t lastDraw = 0;
+
+   applyRealtime();
+   if ( realtime.enabled ) prefaultStack();
+   sock = openReceiveSocket();
+   epollFd = epoll_create1(EPOLL_CLOEXEC);
+   if ( epollFd < 0 ) {
+      cout << "\nError creating the event loop\n";
+      exit(1);
+   }
+
+   // Descriptors are told apart by the fd stored with them
+   int fds[4] = { sock, frameClock.fd(), signalFd, fileno(stdin) };
+   unsigned int numFds = daemonMode ? 3 : 4;
+   for ( unsigned int i = 0; i < numFds; i++ ) {
+      memset(&ev, 0, sizeof(ev));
+      ev.events = EPOLLIN;
+      ev.data.fd = fds[i];
+      epoll_ctl(epollFd, EPOLL_CTL_ADD, fds[i], &ev);
+   }
+
+   engineRunning = true;
+   while ( engineRunning ) {
+      bool onTime = false;
+      bool keyPressed = false;
+      colorCommand cmd;
+
+      frameClock.arm(deadline);
+      int n = epoll_wait(epollFd, events, EVENTLOOP_MAX_EVENTS, -1);
+      if ( n < 0 ) {
+         if ( errno == EINTR ) continue;
+         break;
       }
-      if ( keyPress == 'c' ) {
-         newCommand = true;
-         autoMode = AUTO_DISABLED;
-         // Wait for any autoCycleThread to finish
-         while ( autoActive ) {
-            this_thread::sleep_for(chrono::milliseconds(5));
-         }
-         newCommand = false;
-         autoMode = AUTO_ACTIVE;
-         autoColors.clear();
-         autoColors.push_back({0.0, 0.0, 0.0, 0}); // only one element and all zero colors means set them randomly
-         thread autoCycleT(autoCycleThread, autoColors, crazyDelay);
-         autoCycleT.detach();
-      }
-      if ( keyPress == 'x' ) {
-         newCommand = true;
-         autoMode = AUTO_DISABLED;
-         // Wait for any autoCycleThread to finish
-         while ( autoActive ) {
-            this_thread::sleep_for(chrono::milliseconds(5));
-         }
-         newCommand = false;
-         autoMode = AUTO_ACTIVE;
-         autoColors.clear();
-         autoColors.push_back({1.0, 0.0, 0.0, 2000}); // red
-         autoColors.push_back({0.0, 1.0, 0.0, 2000}); // green
-         thread autoCycleT(autoCycleThread, autoColors, 1000);
-         autoCycleT.detach();
-      }
-      if ( keyPress == '4' ) {
-         newCommand = true;
-         autoMode = AUTO_DISABLED;
-         // Wait for any autoCycleThread to finish
-         while ( autoActive ) {
-            this_thread::sleep_for(chrono::milliseconds(5));
-         }
-         newCommand = false;
-         autoMode = AUTO_ACTIVE;
-         autoColors.clear();
-         autoColors.push_back({1.0, 0.0, 0.0, 1000}); // red
-         autoColors.push_back({0.5, 0.5, 0.5, 1000}); // white
-         autoColors.push_back({0.0, 0.0, 1.0, 1000}); // blue
-         thread autoCycleT(autoCycleThread, autoColors, 1000);
-         autoCycleT.detach();
-      }
-      if ( keyPress == 'e' ) {
-         newCommand = true;
-         autoMode = AUTO_DISABLED;
-         // Wait for any autoCycleThread to finish
-         while ( autoActive ) {
-            this_thread::sleep_for(chrono::milliseconds(5));
-         }
-         newCommand = false;
-         autoMode = AUTO_ACTIVE;
-         autoColors.clear();
-         autoColors.push_back({1.0, 0.012, 0.753, 1000}); // pink
-         autoColors.push_back({0.031, 1.0, 0.969, 1000}); // cyan
-         autoColors.push_back({1.0, 0.988, 0.02, 1000}); // yellow
-         thread autoCycleT(autoCycleThread, autoColors, 1000);
-         autoCycleT.detach();
-      }
-      if ( keyPress == 'h' ) {
-         newCommand = true;
-         autoMode = AUTO_DISABLED;
-         // Wait for any autoCycleThread to finish
-         while ( autoActive ) {
-            this_thread::sleep_for(chrono::milliseconds(5));
-         }
-         newCommand = false;
-         autoMode = AUTO_ACTIVE;
-         autoColors.clear();
-         autoColors.push_back({1.0, 0.094, 0.0, 1000}); // orange
-         autoColors.push_back({0.0, 0.0, 0.0, 250}); // black
-         thread autoCycleT(autoCycleThread, autoColors, 1000);
-         autoCycleT.detach();
-      }
-      if ( keyPress == '.' ) {
-         if ( autoMode != AUTO_DISABLED ) {
-            newCommand = true;
-            autoMode = AUTO_DISABLED;
-            while ( autoActive ) {
-               this_thread::sleep_for(chrono::milliseconds(5));
+
+      for ( int i = 0; (i < n) && engineRunning; i++ ) {
+         int fd = events[i].data.fd;
+         if ( fd == frameClock.fd() ) {
+            frameClock.acknowledge();
+            onTime = true;
+         } else if ( fd == sock ) {
+            // One batch per wakeup keeps a flood from starving the frames;
+            // epoll reports the socket again straight away if there's more
+            receiveBatch(sock, MSG_DONTWAIT);
+         } else if ( fd == signalFd ) {
+            if ( signalShutdown(cmd) ) {
+               executeCommand(cmd);
+               engineRunning = false;
             }
-            newCommand = false;
-            // Set everything back to the "static" values
-            rampColors(redStatic, greenStatic, blueStatic, 1000);
-         }
-      }
-      if ( keyPress == 'q' ) {
-         newCommand = true;
-         if ( autoMode != AUTO_DISABLED ) {
-            cout << "\nWaiting for auto cyclers to stop...";
-            autoMode = AUTO_DISABLED;
-            while ( autoActive ) {
-               this_thread::sleep_for(chrono::milliseconds(5));
+         } else {
+            char keys[16];
+            ssize_t count = read(fileno(stdin), keys, sizeof(keys));
+            for ( ssize_t k = 0; (k < count) && engineRunning; k++ ) {
+               handleKey(keys[k]);
             }
-            cout << "\n\n";
+            keyPressed = true;
          }
-         newCommand = false;
       }
-      resetScreen();
-   }
-
-   // Set all colors to zero and close the Pi-Blaster device
-   setColors(0.0, 0.0, 0.0);
+      if ( !engineRunning ) break;
+
+      // A frame that is due is rendered for its scheduled time rather than
+      // the moment we woke up, unless we are more than a frame behind
+      uint64_t now = FrameClock::now();
+      if ( onTime && (deadline != 0) && (deadline != NO_DEADLINE) && (now >= deadline) ) frameJitter.record((unsigned long)(now - deadline));
+      if ( onTime && (deadline != NO_DEADLINE) && (now >= deadline) && ((now - deadline) < frameClock.framePeriod()) ) {
+         now = deadline;
+      }
+      deadline = runEngine(now);
 
-   // Restore to original settings
-   tcsetattr(fileno(stdin), TCSANOW, &oldSettings);
+      // Redraw on every key and otherwise at most four times a second, only
+      // ever as part of a wakeup that was happening anyway
+      if ( !daemonMode && (keyPressed || (now - lastDraw >= 250000)) ) {
+         resetScreen();
+         lastDraw = now;
+      }
+   }
 
-   return;
+   close(epollFd);
+   close(sock);
 }
 
 string getParameter(string needle, const int argc, const char* argv[]) {
@@ -628,37 +1436,45 @@ string getParameter(string needle, const int argc, const char* argv[]) {
    return NOPARAMETER;
 }
 
-// Catch CTRL-C and set pins to zero
-void sigHandler(int s) {
-   if ( !daemonMode ) {
-      // Restore to original settings
-      tcsetattr(fileno(stdin), TCSANOW, &oldSettings);
-   }
-   // Set all colors to zero and close the Pi-Blaster device
-   setColors(0.0, 0.0, 0.0);
-   close(pbDeviceFd);
-   exit(1);
-}
-
 //
 // Valid command line parameters:
 //    --test   : This makes the output bind to /dev/null instead of the pi-blaster device for testing
+//    --device : Write to another device or a FIFO instead of the pi-blaster device
+//    --output : Also send frames to binary, shared memory ring or text outputs
 //    --daemon : This makes the application run in daemon mode (i.e. no keypress monitoring and no screen output)
 //
 int main (int argc, const char* argv[], char* envp[]) {
    string deviceName = "";
    string pValue;
+   string fixtureError;
+   string gammaName = DEFAULT_GAMMA;
+   string stateName = DEFAULT_STATE_FILE;
+   string outputSpecs = "";
 
-   signal (SIGINT, sigHandler);
-
+   startTime = nowMicros();
    pValue = getParameter("--help", argc, argv);
    if ( pValue != NOPARAMETER ) {
       cout << "\nUsage: pwmdemo [options]\n";
       cout << "   Options:\n";
-      cout << "      --id   : The ID for this daemon. Valid from 0 to 64. Defaults to 0.\n";
+      cout << "      --id   : The IDs this daemon answers to, e.g. 3 or 3,7,20-24. Valid from 1 to 64, 0 for all. Defaults to 0.\n";
+      cout << "      --port : UDP port to listen on. Defaults to " << DEFAULT_UDP_PORT << ".\n";
+      cout << "      --multicast : Base multicast group, or off for broadcast only. Defaults to " << DEFAULT_MULTICAST_BASE << ".\n";
+      cout << "      --mcastif : Local address of the interface to join groups on, e.g. 127.0.0.1. Defaults to the system's choice.\n";
+      cout << "      --state : File (about 530 KB) the levels and patterns are kept in across restarts, or off. One daemon per file. Defaults to " << DEFAULT_STATE_FILE << ".\n";
+      cout << "      --jitter : Milliseconds streamed frames are held back to even out network delay. Defaults to " << DEFAULT_JITTER_DELAY << ".\n";
+      cout << "      --fps  : Frames per second written while ramping. Valid from 1 to 1000. Defaults to 200.\n";
+      cout << "      --resolution : Number of distinct PWM steps the output can produce. Defaults to 1000.\n";
+      cout << "      --fixture : Channel order and GPIO pins of each light, e.g. rgb:23,24,25/grbw:4,17,18,22@2.2. Defaults to " << DEFAULT_FIXTURE << ".\n";
+      cout << "      --gamma : Brightness curve: cie, linear or an exponent such as 2.2. Defaults to " << DEFAULT_GAMMA << ".\n";
       cout << "      --help : This help\n";
       cout << "      --test : Use /dev/null instead of /dev/pi-blaster (for testing)\n";
-      cout << "      --daemon : Don't output to the screen or start the keyPress thread\n\n";
+      cout << "      --device : Write to this file, device or FIFO instead of /dev/pi-blaster\n";
+      cout << "      --output : Also send frames to these, e.g. binary:/tmp/frames,shm:/dev/shm/pwmcolors,text:/dev/pi-blaster2\n";
+      cout << "      --daemon : Don't output to the screen or start the keyPress thread\n";
+      cout << "      --eventloop : Run everything on one thread with a single epoll loop\n";
+      cout << "      --rt   : Render on SCHED_FIFO with memory locked. Optional priority from 1 to 99, defaults to " << DEFAULT_RT_PRIORITY << ".\n";
+      cout << "               With --eventloop the screen and CMD_QUERY run real-time too, and they allocate.\n";
+      cout << "      --cpu  : Pin the render thread to this CPU\n\n";
       return 0;
    }
 
@@ -668,21 +1484,126 @@ int main (int argc, const char* argv[], char* envp[]) {
    } else {
       deviceName = "/dev/pi-blaster";
    }
+   pValue = getParameter("--device", argc, argv);
+   if ( (pValue != NOPARAMETER) && !pValue.empty() ) {
+      deviceName = pValue;
+   }
+
+   pValue = getParameter("--output", argc, argv);
+   if ( pValue != NOPARAMETER ) outputSpecs = pValue;
 
    pValue = getParameter("--daemon", argc, argv);
    if ( pValue != NOPARAMETER ) {
       daemonMode = true;
    }
 
-   pValue = getParameter("--id", argc, argv);
+   pValue = getParameter("--eventloop", argc, argv);
+   if ( pValue != NOPARAMETER ) {
+      eventLoopMode = true;
+   }
+
+   pValue = getParameter("--rt", argc, argv);
+   if ( pValue != NOPARAMETER ) {
+      realtime.enabled = true;
+      if ( !pValue.empty() ) realtime.priority = stoi(pValue);
+      if ( (realtime.priority < 1) || (realtime.priority > 99) ) {
+         cout << "\nERROR: Real-time priority must be between 1 and 99\n\n";
+         return 1;
+      }
+   }
+
+   pValue = getParameter("--cpu", argc, argv);
+   if ( (pValue != NOPARAMETER) && !pValue.empty() ) {
+      realtime.cpu = stoi(pValue);
+      if ( (realtime.cpu < 0) || (realtime.cpu >= CPU_SETSIZE) ) {
+         cout << "\nERROR: CPU must be between 0 and " << (CPU_SETSIZE - 1) << "\n\n";
+         return 1;
+      }
+   }
+
+   pValue = getParameter("--port", argc, argv);
    if ( pValue != NOPARAMETER ) {
-      if ( !pValue.empty() ) myTargetID = (unsigned int)stoi(pValue);
+      if ( !pValue.empty() ) udpPort = (unsigned int)stoi(pValue);
+   }
+   if ( (udpPort < 1) || (udpPort > 65535) ) {
+      cout << "\nERROR: Port must be between 1 and 65535\n\n";
+      return 1;
    }
-   if ( myTargetID > 64 ) {
-      cout << "\nERROR: ID must be between 0 and 64\n\n";
+
+   pValue = getParameter("--multicast", argc, argv);
+   if ( pValue == NOPARAMETER ) pValue = DEFAULT_MULTICAST_BASE;
+   if ( pValue == "off" ) {
+      multicastEnabled = false;
+   } else if ( !parseMulticastBase(pValue, multicastBase) ) {
+      cout << "\nERROR: " << pValue << " is not a multicast address\n\n";
       return 1;
    }
 
+   pValue = getParameter("--mcastif", argc, argv);
+   if ( pValue != NOPARAMETER ) {
+      if ( inet_pton(AF_INET, pValue.c_str(), &multicastInterface) != 1 ) {
+         cout << "\nERROR: " << pValue << " is not an IPv4 address\n\n";
+         return 1;
+      }
+   }
+
+   pValue = getParameter("--state", argc, argv);
+   if ( pValue != NOPARAMETER ) stateName = pValue;
+
+   pValue = getParameter("--jitter", argc, argv);
+   if ( (pValue != NOPARAMETER) && !pValue.empty() ) {
+      int jitterDelay = stoi(pValue);
+      if ( (jitterDelay < 0) || (jitterDelay > 1000) ) {
+         cout << "\nERROR: Jitter delay must be between 0 and 1000 ms\n\n";
+         return 1;
+      }
+      jitterBuffer.setDelay((uint64_t)jitterDelay * 1000);
+   }
+
+   pValue = getParameter("--fps", argc, argv);
+   if ( (pValue != NOPARAMETER) && !pValue.empty() ) {
+      int fps = stoi(pValue);
+      if ( (fps < 1) || (fps > 1000) ) {
+         cout << "\nERROR: Frame rate must be between 1 and 1000 fps\n\n";
+         return 1;
+      }
+      frameClock.setFrameRate((unsigned int)fps);
+   }
+
+   pValue = getParameter("--resolution", argc, argv);
+   if ( pValue != NOPARAMETER ) {
+      if ( !pValue.empty() ) outputResolution = (unsigned int)stoi(pValue);
+   }
+   if ( (outputResolution < 1) || (outputResolution > OUTPUT_DUTY_SCALE) ) {
+      cout << "\nERROR: Resolution must be between 1 and " << OUTPUT_DUTY_SCALE << "\n\n";
+      return 1;
+   }
+
+   pValue = getParameter("--gamma", argc, argv);
+   if ( pValue != NOPARAMETER ) gammaName = pValue;
+
+   pValue = getParameter("--fixture", argc, argv);
+   if ( pValue == NOPARAMETER ) pValue = DEFAULT_FIXTURE;
+   if ( !parseFixture(pValue, gammaName, fixture, fixtureError) ) {
+      cout << "\nERROR: Invalid fixture: " << fixtureError << "\n\n";
+      return 1;
+   }
+
+   pValue = getParameter("--id", argc, argv);
+   if ( pValue != NOPARAMETER ) {
+      uint64_t membership;
+      string idError;
+      if ( !parseTargetIDs(pValue, membership, idError) ) {
+         cout << "\nERROR: " << idError << "\n\n";
+         return 1;
+      }
+      setTargetMembership(membership);
+   }
+
+   // A device or FIFO whose reader has gone away then fails the write
+   // with EPIPE instead of killing us
+   signal(SIGPIPE, SIG_IGN);
+
    // Open the Pi-Blaster device for writing
    pbDeviceFd = open(deviceName.c_str(), O_WRONLY | O_NONBLOCK);
    // Fail out if Pi-Blaster PWM daemon is not available
@@ -690,20 +1611,76 @@ int main (int argc, const char* argv[], char* envp[]) {
       cout << "\nERROR: Could not open " << deviceName << "\n\n";
       return 1;
    }
+   output.setFd(pbDeviceFd);
+   outputs.add(&output, deviceName);
+
+   // Then any other backends. They are never freed; they live as long as we do.
+   for ( size_t pos = 0; pos < outputSpecs.size(); ) {
+      size_t comma = outputSpecs.find(',', pos);
+      if ( comma == string::npos ) comma = outputSpecs.size();
+      string outputError;
+      OutputBackend *backend = openOutput(outputSpecs.substr(pos, comma - pos), outputError);
+      if ( backend == NULL ) {
+         cout << "\nERROR: " << outputError << "\n\n";
+         return 1;
+      }
+      if ( !outputs.add(backend, outputSpecs.substr(pos, comma - pos)) ) {
+         cout << "\nERROR: At most " << (OUTPUT_MAX_BACKENDS - 1) << " outputs can be added\n\n";
+         return 1;
+      }
+      pos = comma + 1;
+   }
 
-   // If we are in daemon mode, don't start the keypress thread or write to the screen
-   // Always start the remoteColor thread, but detach it if not in daemon mode
-   if ( daemonMode ) {
-      thread remoteColorT(remoteColorThread);
-      remoteColorT.join();
+   // Come back the way the last run left things if we can, otherwise
+   // start from all off. Either way this is before the network is up.
+   loadPresetPatterns();
+   if ( stateName != "off" ) {
+      string stateError;
+      if ( !stateFile.open(stateName, stateError) && !daemonMode ) {
+         cout << "\nWarning: " << stateError << ", state will not be kept\n";
+      }
+   }
+   if ( stateFile.restored() != NULL ) {
+      restoreState(stateFile.restored());
    } else {
+      setColors(0.0, 0.0, 0.0);
+   }
+
+   // Shutdown signals are delivered through signalFd from here on, so this
+   // has to happen before any thread is started
+   signalFd = openSignalFd();
+
+   // Everything is allocated by now. Locking memory before any thread is
+   // started also gives the threads small, fully resident stacks.
+   if ( realtime.enabled ) {
+      string lockError;
+      memoryLocked = lockMemory(lockError);
+      if ( !memoryLocked && daemonMode ) cout << "Warning: " << lockError << "\n";
+   }
+
+   // If we are in daemon mode, don't start the keypress thread or write to the screen.
+   // The render thread decides when we are done: on 'q' or a shutdown signal.
+   if ( !daemonMode ) {
+      startKeyboard();
       resetScreen();
-      thread keyPressT(keyPressThread);
+   }
+   if ( eventLoopMode ) {
+      eventLoop();
+   } else {
+      thread renderT(renderThread);
+      while ( !renderStarted ) this_thread::sleep_for(chrono::milliseconds(1));
       thread remoteColorT(remoteColorThread);
       remoteColorT.detach();
-      keyPressT.join();
+      if ( !daemonMode ) {
+         thread keyPressT(keyPressThread);
+         keyPressT.detach();
+      }
+      renderT.join();
    }
 
+   // Restore to original settings
+   if ( !daemonMode ) tcsetattr(fileno(stdin), TCSANOW, &oldSettings);
+
    close(pbDeviceFd);
    return 0;
 }
@@ -0,0 +1,85 @@
+#include <cstring>
+
+#include <errno.h>
+#include <malloc.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "realtime.h"
+
+using namespace std;
+
+bool lockMemory(string &error) {
+   pthread_attr_t attr;
+
+   // Freed memory stays with malloc and large blocks come from the locked
+   // heap rather than fresh mappings. A single arena stops every thread
+   // that allocates from reserving (and so locking) an arena of its own.
+   mallopt(M_TRIM_THRESHOLD, -1);
+   mallopt(M_MMAP_MAX, 0);
+   mallopt(M_ARENA_MAX, 1);
+
+   if ( pthread_attr_init(&attr) == 0 ) {
+      pthread_attr_setstacksize(&attr, RT_THREAD_STACK);
+      pthread_setattr_default_np(&attr);
+      pthread_attr_destroy(&attr);
+   }
+
+   if ( mlockall(MCL_CURRENT | MCL_FUTURE) != 0 ) {
+      error = string("could not lock memory: ") + strerror(errno);
+      return false;
+   }
+   return true;
+}
+
+bool enterRealtime(pthread_t thread, const realtimeConfig &config, string &error) {
+   bool ok = true;
+   int result;
+
+   if ( config.cpu >= 0 ) {
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      CPU_SET(config.cpu, &cpus);
+      result = pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+      if ( result != 0 ) {
+         error = "could not pin to CPU " + to_string(config.cpu) + ": " + strerror(result);
+         ok = false;
+      }
+   }
+
+   if ( config.enabled ) {
+      struct sched_param param;
+      memset(&param, 0, sizeof(param));
+      param.sched_priority = config.priority;
+      result = pthread_setschedparam(thread, SCHED_FIFO, &param);
+      if ( result != 0 ) {
+         if ( !ok ) error += ", ";
+         error += "could not set SCHED_FIFO " + to_string(config.priority) + ": " + strerror(result);
+         ok = false;
+      }
+   }
+   return ok;
+}
+
+// Kept out of line so the array really is on this frame's stack
+__attribute__((noinline)) void prefaultStack() {
+   volatile unsigned char stack[RT_STACK_PREFAULT];
+
+   // One write per page is enough to fault it in, and no page is smaller
+   for ( unsigned int i = 0; i < RT_STACK_PREFAULT; i += 4096 ) stack[i] = 0;
+
+   // Read one back, which also counts as using the array
+   (void)stack[0];
+}
+
+string realtimeDescription(const realtimeConfig &config, bool locked) {
+   string description;
+
+   if ( config.enabled ) {
+      description = "SCHED_FIFO " + to_string(config.priority) + (locked ? ", memory locked" : ", memory not locked");
+   } else {
+      description = "off";
+   }
+   if ( config.cpu >= 0 ) description += ", CPU " + to_string(config.cpu);
+   return description;
+}
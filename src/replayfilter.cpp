@@ -0,0 +1,63 @@
+#include "replayfilter.h"
+
+ReplayFilter::ReplayFilter() : useCounter(0), duplicateCount(0), evictionCount(0) {
+   for ( unsigned int i = 0; i < REPLAY_SOURCES; i++ ) sources[i].used = false;
+}
+
+bool ReplayFilter::accept(uint32_t address, uint16_t port, uint32_t messageID) {
+   source *entry = 0;
+   source *oldest = &sources[0];
+
+   for ( unsigned int i = 0; i < REPLAY_SOURCES; i++ ) {
+      source &s = sources[i];
+      if ( s.used && (s.address == address) && (s.port == port) ) {
+         entry = &s;
+         break;
+      }
+      // Prefer an unused slot, otherwise the least recently heard sender
+      if ( oldest->used && (!s.used || (s.lastUsed < oldest->lastUsed)) ) oldest = &s;
+   }
+   useCounter++;
+
+   if ( entry == 0 ) {
+      if ( oldest->used ) evictionCount++;
+      entry = oldest;
+      entry->address = address;
+      entry->port = port;
+      entry->used = true;
+      entry->newest = messageID;
+      entry->seen = 1;
+      entry->lastUsed = useCounter;
+      return true;
+   }
+   entry->lastUsed = useCounter;
+
+   // Signed distance so the IDs can wrap around
+   int32_t ahead = (int32_t)(messageID - entry->newest);
+
+   if ( ahead > 0 ) {
+      // Newer than anything so far: slide the window forward
+      entry->seen = (ahead >= REPLAY_WINDOW) ? 1 : ((entry->seen << ahead) | 1);
+      entry->newest = messageID;
+      return true;
+   }
+
+   uint32_t behind = (uint32_t)(-(int64_t)ahead);
+   if ( behind >= REPLAY_RESYNC ) {
+      // The sender has restarted its numbering, start over with it
+      entry->newest = messageID;
+      entry->seen = 1;
+      return true;
+   }
+   if ( behind >= REPLAY_WINDOW ) {
+      duplicateCount++;
+      return false;
+   }
+   uint64_t bit = (uint64_t)1 << behind;
+   if ( entry->seen & bit ) {
+      duplicateCount++;
+      return false;
+   }
+   entry->seen |= bit;
+   return true;
+}
@@ -0,0 +1,77 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "shmring.h"
+#include "telemetry.h"
+
+using namespace std;
+
+// Readers in other processes rely on these being plain 32 bit words
+static_assert(sizeof(atomic<uint32_t>) == 4, "32 bit atomics must be plain words");
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "32 bit atomics must be lock free to be shared");
+static_assert(sizeof(ringSlot) == 128, "ringSlot layout changed");
+
+ShmRing::ShmRing() : mapped(NULL), framesCount(0) {
+}
+
+ShmRing::~ShmRing() {
+   if ( mapped != NULL ) munmap(mapped, sizeof(ringHeader));
+}
+
+bool ShmRing::open(const string &path, string &error) {
+   void *map;
+   int fd;
+
+   fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+   if ( fd < 0 ) {
+      error = "unable to open " + path + ": " + strerror(errno);
+      return false;
+   }
+   if ( ftruncate(fd, sizeof(ringHeader)) < 0 ) {
+      error = "unable to size " + path + ": " + strerror(errno);
+      ::close(fd);
+      return false;
+   }
+   map = mmap(NULL, sizeof(ringHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   ::close(fd);
+   if ( map == MAP_FAILED ) {
+      error = "unable to map " + path + ": " + strerror(errno);
+      return false;
+   }
+   mapped = (ringHeader *)map;
+
+   // Start empty. A reader of a previous run sees the magic disappear and
+   // come back with head reset.
+   mapped->magic = 0;
+   atomic_thread_fence(memory_order_release);
+   mapped->head.store(0, memory_order_relaxed);
+   for ( unsigned int i = 0; i < RING_SLOTS; i++ ) mapped->slots[i].sequence.store(0, memory_order_relaxed);
+   mapped->version = RING_VERSION;
+   mapped->slotCount = RING_SLOTS;
+   mapped->slotSize = sizeof(ringSlot);
+   atomic_thread_fence(memory_order_release);
+   mapped->magic = RING_MAGIC;
+   return true;
+}
+
+bool ShmRing::write(const outputFrame &frame) {
+   ringSlot *slot;
+
+   // The newest frame stays in the ring, so there's nothing to catch up on
+   if ( !frame.changed || (mapped == NULL) ) return true;
+
+   slot = &mapped->slots[frame.sequence % RING_SLOTS];
+   slot->sequence.store(0, memory_order_relaxed);
+   atomic_thread_fence(memory_order_release);
+   slot->numPins = frame.numPins;
+   slot->time = frame.time;
+   memcpy(slot->pin, frame.pin, frame.numPins);
+   memcpy(slot->duty, frame.duty, frame.numPins * sizeof(frame.duty[0]));
+   slot->sequence.store(frame.sequence, memory_order_release);
+   mapped->head.store(frame.sequence, memory_order_release);
+   bumpCounter(framesCount);
+   return true;
+}
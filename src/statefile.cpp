@@ -0,0 +1,93 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "statefile.h"
+
+using namespace std;
+
+StateFile::StateFile() : fd(-1), mapped(0), wasValid(false) {
+}
+
+StateFile::~StateFile() {
+   if ( mapped != 0 ) munmap(mapped, sizeof(persistentState));
+   if ( fd >= 0 ) ::close(fd);
+}
+
+bool StateFile::open(const string &path, string &error) {
+   struct stat st;
+   void *map;
+
+   // Create the directory the file lives in, but not a whole tree
+   size_t slash = path.rfind('/');
+   if ( (slash != string::npos) && (slash > 0) ) mkdir(path.substr(0, slash).c_str(), 0755);
+
+   fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+   if ( fd < 0 ) {
+      error = "unable to open " + path + ": " + strerror(errno);
+      return false;
+   }
+   // Held until we exit, which also releases it if we die
+   if ( flock(fd, LOCK_EX | LOCK_NB) < 0 ) {
+      error = path + " is in use by another instance";
+      ::close(fd);
+      fd = -1;
+      return false;
+   }
+   if ( (fstat(fd, &st) < 0) || (((size_t)st.st_size != sizeof(persistentState)) && (ftruncate(fd, sizeof(persistentState)) < 0)) ) {
+      error = "unable to size " + path + ": " + strerror(errno);
+      ::close(fd);
+      fd = -1;
+      return false;
+   }
+   map = mmap(NULL, sizeof(persistentState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   if ( map == MAP_FAILED ) {
+      error = "unable to map " + path + ": " + strerror(errno);
+      ::close(fd);
+      fd = -1;
+      return false;
+   }
+   mapped = (persistentState *)map;
+
+   wasValid = ((size_t)st.st_size == sizeof(persistentState)) &&
+              (mapped->magic == STATE_MAGIC) &&
+              (mapped->version == STATE_VERSION) &&
+              (mapped->size == sizeof(persistentState));
+   if ( !wasValid ) {
+      memset(mapped, 0, sizeof(persistentState));
+      mapped->magic = STATE_MAGIC;
+      mapped->version = STATE_VERSION;
+      mapped->size = sizeof(persistentState);
+   }
+   return true;
+}
+
+void StateFile::saveLevels(double red, double green, double blue) {
+   if ( mapped == 0 ) return;
+   mapped->redStatic = red;
+   mapped->greenStatic = green;
+   mapped->blueStatic = blue;
+}
+
+void StateFile::saveActivePattern(bool active, const storedPattern *pattern) {
+   if ( mapped == 0 ) return;
+   mapped->patternActive = active;
+   mapped->effectActive = false;
+   if ( active && (pattern != 0) ) copyPattern(mapped->activePattern, *pattern);
+}
+
+void StateFile::saveActiveEffect(const effectParams &effect) {
+   if ( mapped == 0 ) return;
+   mapped->patternActive = false;
+   mapped->effectActive = true;
+   mapped->activeEffect = effect;
+}
+
+void StateFile::savePattern(unsigned int id, const storedPattern &pattern) {
+   if ( (mapped == 0) || (id >= PATTERN_SLOTS) ) return;
+   copyPattern(mapped->patterns[id], pattern);
+}
@@ -0,0 +1,54 @@
+#include "telemetry.h"
+
+using namespace std;
+
+Histogram::Histogram() : total(0), largest(0) {
+   for ( unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++ ) buckets[i] = 0;
+}
+
+void Histogram::record(unsigned long micros) {
+   unsigned int i = 0;
+
+   // The bucket is the bit length of the value
+   if ( micros != 0 ) i = (sizeof(unsigned long) * 8) - __builtin_clzl(micros);
+   if ( i >= HISTOGRAM_BUCKETS ) i = HISTOGRAM_BUCKETS - 1;
+
+   buckets[i].store(buckets[i].load(memory_order_relaxed) + 1, memory_order_relaxed);
+   total.store(total.load(memory_order_relaxed) + 1, memory_order_relaxed);
+   if ( micros > largest.load(memory_order_relaxed) ) largest.store(micros, memory_order_relaxed);
+}
+
+unsigned long Histogram::bucketLimit(unsigned int i) {
+   if ( i == 0 ) return 0;
+   if ( i >= HISTOGRAM_BUCKETS - 1 ) return ~0UL;
+   return (1UL << i) - 1;
+}
+
+unsigned long Histogram::percentile(unsigned int percent) const {
+   unsigned long n = count();
+   unsigned long seen = 0;
+
+   if ( n == 0 ) return 0;
+   // The rank of the sample we are after, rounded up
+   unsigned long rank = (n * percent + 99) / 100;
+   if ( rank == 0 ) rank = 1;
+   for ( unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++ ) {
+      seen += bucket(i);
+      if ( seen >= rank ) return (bucketLimit(i) < max()) ? bucketLimit(i) : max();
+   }
+   return max();
+}
+
+void Histogram::appendJSON(string &out) const {
+   unsigned int used = HISTOGRAM_BUCKETS;
+
+   while ( (used > 0) && (bucket(used - 1) == 0) ) used--;
+   out += "{\"count\":" + to_string(count()) + ",\"max\":" + to_string(max());
+   out += ",\"p50\":" + to_string(percentile(50)) + ",\"p99\":" + to_string(percentile(99));
+   out += ",\"buckets\":[";
+   for ( unsigned int i = 0; i < used; i++ ) {
+      if ( i > 0 ) out += ",";
+      out += to_string(bucket(i));
+   }
+   out += "]}";
+}
@@ -0,0 +1,31 @@
+#include "timesync.h"
+
+using namespace std;
+
+TimeSync::TimeSync() : count(0), next(0), offset(0), beaconCount(0), correctionShown(0), spreadShown(0) {
+}
+
+void TimeSync::addBeacon(uint64_t sharedTime, uint64_t localTime) {
+   // Offsets are kept modulo 2^64, so compare them as differences
+   uint64_t sample = sharedTime - localTime;
+   int64_t jump = (int64_t)(sample - offset);
+
+   if ( (count > 0) && ((jump > SYNC_RESET) || (jump < -SYNC_RESET)) ) count = 0;
+   if ( count == 0 ) next = 0;
+   samples[next] = sample;
+   next = (next + 1) % SYNC_WINDOW;
+   if ( count < SYNC_WINDOW ) count++;
+
+   // The fastest beacon implies the largest offset
+   uint64_t best = samples[0];
+   uint64_t worst = samples[0];
+   for ( unsigned int i = 1; i < count; i++ ) {
+      if ( (int64_t)(samples[i] - best) > 0 ) best = samples[i];
+      if ( (int64_t)(samples[i] - worst) < 0 ) worst = samples[i];
+   }
+
+   correctionShown = (count > 1) ? (long)(int64_t)(best - offset) : 0;
+   spreadShown = (unsigned long)(best - worst);
+   offset = best;
+   beaconCount.fetch_add(1, memory_order_relaxed);
+}
@@ -0,0 +1,160 @@
+#include <iostream>
+#include <string>
+#include <cstdlib>
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "outputbackend.h"
+#include "binaryoutput.h"
+#include "shmring.h"
+
+//
+// Prints the frames pwmcolors sends to a binary or shared memory ring
+// output (--output), one line per frame: sequence number, monotonic time
+// in microseconds and pin=duty for every pin, duties out of 10000. A
+// starting point for simulators and recorders.
+//
+// Usage: pwmframes [--count=N] binary:PATH | shm:PATH
+//
+//   binary:PATH reads records from a file or FIFO until it ends. shm:PATH
+//   follows a ring, reading each frame in place, and reports frames it was
+//   too slow to see.
+//
+
+using namespace std;
+
+// Time between looks at a ring's head
+#define RING_POLL_US 1000
+
+void printFrame(const outputFrame &frame) {
+   cout << frame.sequence << " " << frame.time;
+   for ( unsigned int i = 0; i < frame.numPins; i++ ) {
+      cout << " " << (unsigned int)frame.pin[i] << "=" << frame.duty[i];
+   }
+   cout << "\n";
+}
+
+int readBinary(const string &path, unsigned long count) {
+   unsigned char buf[4096];
+   size_t length = 0;
+   unsigned long seen = 0;
+   outputFrame frame;
+   int fd;
+
+   fd = open(path.c_str(), O_RDONLY);
+   if ( fd < 0 ) {
+      cerr << "Unable to open " << path << ": " << strerror(errno) << "\n";
+      return 1;
+   }
+   while ( seen < count ) {
+      ssize_t got = read(fd, buf + length, sizeof(buf) - length);
+      if ( got <= 0 ) break;
+      length += got;
+
+      size_t pos = 0;
+      while ( (pos < length) && (seen < count) ) {
+         size_t used = decodeBinaryFrame(buf + pos, length - pos, frame);
+         if ( used == 0 ) {
+            // Either the rest of a record is still to come or this isn't
+            // the start of one; skip a byte only in the second case
+            if ( (length - pos >= BINARY_FRAME_MAX) || ((length - pos >= 4) && memcmp(buf + pos, "PMCF", 4) != 0) ) {
+               pos++;
+               continue;
+            }
+            break;
+         }
+         printFrame(frame);
+         seen++;
+         pos += used;
+      }
+      memmove(buf, buf + pos, length - pos);
+      length -= pos;
+   }
+   close(fd);
+   return 0;
+}
+
+int readRing(const string &path, unsigned long count) {
+   const ringHeader *ring;
+   unsigned long seen = 0;
+   unsigned long missed = 0;
+   uint32_t next;
+   void *map;
+   int fd;
+
+   fd = open(path.c_str(), O_RDONLY);
+   if ( fd < 0 ) {
+      cerr << "Unable to open " << path << ": " << strerror(errno) << "\n";
+      return 1;
+   }
+   map = mmap(NULL, sizeof(ringHeader), PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if ( map == MAP_FAILED ) {
+      cerr << "Unable to map " << path << ": " << strerror(errno) << "\n";
+      return 1;
+   }
+   ring = (const ringHeader *)map;
+   if ( (ring->magic != RING_MAGIC) || (ring->version != RING_VERSION) || (ring->slotSize != sizeof(ringSlot)) ) {
+      cerr << path << " is not a pwmcolors ring of this version\n";
+      return 1;
+   }
+
+   // Start with the newest frame
+   next = ring->head.load(memory_order_acquire);
+   if ( next == 0 ) next = 1;
+   while ( seen < count ) {
+      uint32_t head = ring->head.load(memory_order_acquire);
+      if ( (int32_t)(head - next) < 0 ) {
+         usleep(RING_POLL_US);
+         continue;
+      }
+      if ( head - next >= RING_SLOTS ) {
+         missed += head - next - (RING_SLOTS - 1);
+         next = head - (RING_SLOTS - 1);
+      }
+
+      // Straight from the mapping; only what is printed is copied
+      const ringSlot *slot = ringFrame(ring, next);
+      outputFrame frame;
+      if ( slot != NULL ) {
+         frame.sequence = next;
+         frame.time = slot->time;
+         frame.numPins = (slot->numPins > OUTPUT_MAX_PINS) ? OUTPUT_MAX_PINS : slot->numPins;
+         memcpy(frame.pin, slot->pin, frame.numPins);
+         memcpy(frame.duty, slot->duty, frame.numPins * sizeof(frame.duty[0]));
+      }
+      if ( (slot != NULL) && ringStillValid(slot, next) ) {
+         printFrame(frame);
+         seen++;
+      } else {
+         missed++;
+      }
+      next++;
+      if ( next == 0 ) next = 1;
+   }
+   if ( missed > 0 ) cerr << missed << " frames missed\n";
+   return 0;
+}
+
+int main(int argc, const char* argv[]) {
+   unsigned long count = (unsigned long)-1;
+   string spec;
+
+   for ( int i = 1; i < argc; i++ ) {
+      if ( strncmp(argv[i], "--count=", 8) == 0 ) {
+         count = strtoul(argv[i] + 8, NULL, 10);
+      } else {
+         spec = argv[i];
+      }
+   }
+
+   if ( spec.compare(0, 7, "binary:") == 0 ) return readBinary(spec.substr(7), count);
+   if ( spec.compare(0, 4, "shm:") == 0 ) return readRing(spec.substr(4), count);
+   cout << "Usage: pwmframes [--count=N] binary:PATH | shm:PATH\n";
+   return 1;
+}
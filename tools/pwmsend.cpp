@@ -0,0 +1,545 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstdio>
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "pwmcolors.h"
+#include "packet.h"
+#include "multicast.h"
+#include "patternupload.h"
+
+//
+// Command line sender for the pwmcolors UDP protocol.
+//
+// Usage: pwmsend [options] command [arguments]
+//
+//   Commands:
+//      off
+//      set R G B [rampMs]               Levels are 0 - 255
+//      pattern rampMs R,G,B,restMs ...  Up to MAX_TRIPLETS colors
+//      store ID rampMs R,G,B,restMs ... Upload a pattern under ID
+//      play ID                          Play a stored pattern
+//      upload ID rampMs STEPS ...       Upload a pattern of up to
+//                                       PATTERN_MAX_STEPS steps in chunks.
+//                                       Each step is R,G,B,restMs, or
+//                                       @file for a file of such lines.
+//      stream FPS FRAMES [R,G,B ...]    Stream FRAMES frames at FPS per
+//                                       second, cycling through the colors
+//                                       given or around the color wheel
+//      effect TYPE periodMs [seed] [R,G,B ...]
+//                                       Play breathe, rainbow, flicker or
+//                                       strobe with up to EFFECT_MAX_COLORS
+//                                       colors. The seed defaults to the
+//                                       message ID.
+//      beacon [intervalMs [count]]      Send time sync beacons, every second
+//                                       and until stopped by default
+//      query [waitMs]                   Ask the targets for their telemetry
+//                                       and print every answer that comes
+//                                       back within waitMs (default 500),
+//                                       one line of JSON per target
+//      autodisable
+//      settargets IDs                   e.g. 3,7,20-24 or 0 for all
+//
+//   Options:
+//      --host=ADDR      Send to ADDR. Defaults to 255.255.255.255.
+//      --port=N         Defaults to 6565.
+//      --id=IDs         Targets of the message. Defaults to 0 (all).
+//      --multicast[=B]  Send to the targets' multicast groups instead of
+//                       --host, with base group B (default 239.65.65.0)
+//      --mcastif=ADDR   Local address of the interface to multicast from
+//      --repeat=N       Send every message N times (same message ID)
+//      --raw            Upload steps as they are instead of delta encoded
+//      --loss=PERCENT   Leave out this share of stream frames, for testing
+//      --at=MS          Have the targets run off, set, pattern, play,
+//                       effect or autodisable MS milliseconds from now on the time
+//                       base set by beacons. Patterns and effects run
+//                       on that time base, so targets that got the command stay in step.
+//
+// Beacons and --at both use this machine's real time clock, so a beacon
+// sender and any number of other pwmsend runs agree on the time base.
+//
+
+using namespace std;
+
+string getOption(const string &name, int &argc, const char* argv[], bool &found) {
+   found = false;
+   for ( int i = 1; i < argc; i++ ) {
+      string arg = argv[i];
+      if ( arg.compare(0, name.length(), name) != 0 ) continue;
+      if ( (arg.length() > name.length()) && (arg[name.length()] != '=') ) continue;
+      found = true;
+      for ( int j = i; j < argc - 1; j++ ) argv[j] = argv[j + 1];
+      argc--;
+      return (arg.length() > name.length()) ? arg.substr(name.length() + 1) : "";
+   }
+   return "";
+}
+
+void usage() {
+   cout << "Usage: pwmsend [--host=ADDR] [--port=N] [--id=IDs] [--multicast[=BASE]] [--mcastif=ADDR] [--repeat=N] [--raw] [--loss=PERCENT] [--at=MS] command [arguments]\n";
+   cout << "   Commands: off | set R G B [rampMs] | pattern rampMs R,G,B,restMs ... | store ID rampMs R,G,B,restMs ... | play ID | upload ID rampMs R,G,B,restMs|@file ... | stream FPS FRAMES [R,G,B ...] | effect breathe|rainbow|flicker|strobe periodMs [seed] [R,G,B ...] | beacon [intervalMs [count]] | query [waitMs] | autodisable | settargets IDs\n";
+}
+
+// Largest telemetry answer we take
+#define UDP_REPLY_SIZE 4096
+
+// Step data per chunk, small enough that a chunk never fragments
+#define CHUNK_DATA_SIZE 1200
+
+// Read steps given as R,G,B,restMs, either directly or one per line from
+// @file. Returns false with a message in error if one isn't a step.
+bool readSteps(const char *arg, vector<patternStep> &steps, string &error) {
+   vector<string> lines;
+
+   if ( arg[0] == '@' ) {
+      FILE *file = fopen(arg + 1, "r");
+      char line[256];
+      if ( file == NULL ) {
+         error = string("unable to open ") + (arg + 1);
+         return false;
+      }
+      while ( fgets(line, sizeof(line), file) != NULL ) {
+         if ( (line[0] != '\n') && (line[0] != '#') ) lines.push_back(line);
+      }
+      fclose(file);
+   } else {
+      lines.push_back(arg);
+   }
+
+   for ( unsigned int i = 0; i < lines.size(); i++ ) {
+      unsigned int red, green, blue, rest;
+      patternStep step;
+      if ( (sscanf(lines[i].c_str(), "%u,%u,%u,%u", &red, &green, &blue, &rest) != 4) || (red > 255) || (green > 255) || (blue > 255) ) {
+         error = "steps are R,G,B,restMs, not '" + lines[i] + "'";
+         return false;
+      }
+      step.red = red;
+      step.green = green;
+      step.blue = blue;
+      step.restDuration = rest;
+      steps.push_back(step);
+   }
+   return true;
+}
+
+void append16(vector<unsigned char> &packet, uint16_t value) {
+   unsigned char bytes[2];
+   memcpy(bytes, &value, 2);
+   packet.insert(packet.end(), bytes, bytes + 2);
+}
+
+void append32(vector<unsigned char> &packet, uint32_t value) {
+   unsigned char bytes[4];
+   memcpy(bytes, &value, 4);
+   packet.insert(packet.end(), bytes, bytes + 4);
+}
+
+void append64(vector<unsigned char> &packet, uint64_t value) {
+   unsigned char bytes[8];
+   memcpy(bytes, &value, 8);
+   packet.insert(packet.end(), bytes, bytes + 8);
+}
+
+// The shared time base: real time in microseconds
+uint64_t sharedNow() {
+   struct timespec ts;
+   clock_gettime(CLOCK_REALTIME, &ts);
+   return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+int main(int argc, const char* argv[]) {
+   string host = "255.255.255.255";
+   unsigned int port = DEFAULT_UDP_PORT;
+   uint64_t targets = 0;
+   bool multicast = false;
+   in_addr_t multicastBase;
+   in_addr_t multicastInterface = INADDR_ANY;
+   unsigned int repeat = 1;
+   string error;
+   string value;
+   bool found;
+
+   value = getOption("--host", argc, argv, found);
+   if ( found ) host = value;
+   value = getOption("--port", argc, argv, found);
+   if ( found ) port = strtoul(value.c_str(), NULL, 10);
+   value = getOption("--id", argc, argv, found);
+   if ( found ) {
+      if ( !parseTargetIDs(value, targets, error) ) {
+         cout << "ERROR: " << error << "\n";
+         return 1;
+      }
+      if ( targets == TARGETS_ALL ) targets = 0;
+   }
+   value = getOption("--multicast", argc, argv, found);
+   if ( found ) {
+      multicast = true;
+      if ( value.empty() ) value = DEFAULT_MULTICAST_BASE;
+      if ( !parseMulticastBase(value, multicastBase) ) {
+         cout << "ERROR: " << value << " is not a multicast address\n";
+         return 1;
+      }
+   }
+   value = getOption("--mcastif", argc, argv, found);
+   if ( found && (inet_pton(AF_INET, value.c_str(), &multicastInterface) != 1) ) {
+      cout << "ERROR: " << value << " is not an IPv4 address\n";
+      return 1;
+   }
+   value = getOption("--loss", argc, argv, found);
+   unsigned int loss = found ? strtoul(value.c_str(), NULL, 10) : 0;
+   value = getOption("--at", argc, argv, found);
+   bool at = found;
+   uint64_t executeAt = sharedNow() + (strtoull(value.c_str(), NULL, 10) * 1000);
+   getOption("--raw", argc, argv, found);
+   bool raw = found;
+   value = getOption("--repeat", argc, argv, found);
+   if ( found ) repeat = strtoul(value.c_str(), NULL, 10);
+   if ( repeat < 1 ) repeat = 1;
+
+   if ( argc < 2 ) {
+      usage();
+      return 1;
+   }
+
+   // Message IDs only have to go up per sender, so the clock will do
+   struct timespec ts;
+   clock_gettime(CLOCK_REALTIME, &ts);
+   uint32_t messageID = (uint32_t)((ts.tv_sec * 1000) + (ts.tv_nsec / 1000000));
+
+   // Build the packet, or for uploads all of them
+   string command = argv[1];
+   vector<unsigned char> packet(PACKET_HEADER_SIZE);
+   vector< vector<unsigned char> > packets;
+   // Stream frames are sent at their timestamps instead of all at once
+   bool paced = false;
+   if ( command == "off" ) {
+      buildPacketHeader(&packet[0], messageID, CMD_OFF, targets);
+   } else if ( command == "autodisable" ) {
+      buildPacketHeader(&packet[0], messageID, CMD_AUTODISABLE, targets);
+   } else if ( (command == "set") && (argc >= 5) ) {
+      buildPacketHeader(&packet[0], messageID, CMD_SETLEVELS, targets);
+      append32(packet, (argc >= 6) ? strtoul(argv[5], NULL, 10) : 0);
+      for ( int i = 2; i < 5; i++ ) packet.push_back((unsigned char)strtoul(argv[i], NULL, 10));
+   } else if ( ((command == "pattern") && (argc >= 4) && (argc - 3 <= MAX_TRIPLETS)) ||
+               ((command == "store") && (argc >= 5) && (argc - 4 <= MAX_TRIPLETS)) ) {
+      // A stored pattern is the ID followed by an ordinary pattern
+      int first = 2;
+      if ( command == "store" ) {
+         buildPacketHeader(&packet[0], messageID, CMD_STOREPATTERN, targets);
+         packet.push_back((unsigned char)strtoul(argv[2], NULL, 10));
+         first = 3;
+      } else {
+         buildPacketHeader(&packet[0], messageID, CMD_AUTOPATTERN, targets);
+      }
+      append32(packet, strtoul(argv[first], NULL, 10));
+      packet.push_back((unsigned char)(argc - first - 1));
+      for ( int i = first + 1; i < argc; i++ ) {
+         unsigned int red, green, blue, rest;
+         if ( sscanf(argv[i], "%u,%u,%u,%u", &red, &green, &blue, &rest) != 4 ) {
+            cout << "ERROR: colors are R,G,B,restMs, not '" << argv[i] << "'\n";
+            return 1;
+         }
+         packet.push_back((unsigned char)red);
+         packet.push_back((unsigned char)green);
+         packet.push_back((unsigned char)blue);
+         append32(packet, rest);
+      }
+   } else if ( (command == "play") && (argc >= 3) ) {
+      buildPacketHeader(&packet[0], messageID, CMD_PLAYPATTERN, targets);
+      packet.push_back((unsigned char)strtoul(argv[2], NULL, 10));
+   } else if ( (command == "upload") && (argc >= 5) ) {
+      vector<patternStep> steps;
+      unsigned int id = strtoul(argv[2], NULL, 10);
+      uint32_t rampDuration = strtoul(argv[3], NULL, 10);
+      for ( int i = 4; i < argc; i++ ) {
+         if ( !readSteps(argv[i], steps, error) ) {
+            cout << "ERROR: " << error << "\n";
+            return 1;
+         }
+      }
+      if ( steps.size() > PATTERN_MAX_STEPS ) {
+         cout << "ERROR: a pattern has at most " << PATTERN_MAX_STEPS << " steps\n";
+         return 1;
+      }
+
+      // Every chunk of one upload carries the same sequence number
+      uint16_t sequence = (uint16_t)messageID;
+      unsigned int offset = 0;
+      while ( offset < steps.size() ) {
+         unsigned char data[CHUNK_DATA_SIZE];
+         unsigned int consumed;
+         size_t length;
+
+         if ( raw ) {
+            consumed = steps.size() - offset;
+            if ( consumed > CHUNK_DATA_SIZE / PACKET_TRIPLET_SIZE ) consumed = CHUNK_DATA_SIZE / PACKET_TRIPLET_SIZE;
+            for ( unsigned int i = 0; i < consumed; i++ ) {
+               const patternStep &step = steps[offset + i];
+               data[(i * PACKET_TRIPLET_SIZE)] = step.red;
+               data[(i * PACKET_TRIPLET_SIZE) + 1] = step.green;
+               data[(i * PACKET_TRIPLET_SIZE) + 2] = step.blue;
+               memcpy(data + (i * PACKET_TRIPLET_SIZE) + 3, &step.restDuration, 4);
+            }
+            length = consumed * PACKET_TRIPLET_SIZE;
+         } else {
+            length = encodeChunkSteps(&steps[offset], steps.size() - offset, data, sizeof(data), consumed);
+         }
+
+         packet.assign(PACKET_HEADER_SIZE, 0);
+         buildPacketHeader(&packet[0], messageID++, CMD_PATTERNCHUNK, targets);
+         packet.push_back((unsigned char)id);
+         append16(packet, sequence);
+         append16(packet, offset);
+         append16(packet, steps.size());
+         append32(packet, rampDuration);
+         packet.push_back(raw ? CHUNK_RAW : CHUNK_DELTA);
+         packet.insert(packet.end(), data, data + length);
+         packets.push_back(packet);
+         offset += consumed;
+      }
+      cout << steps.size() << " steps in " << packets.size() << " chunks\n";
+   } else if ( (command == "stream") && (argc >= 4) ) {
+      unsigned int fps = strtoul(argv[2], NULL, 10);
+      unsigned int frames = strtoul(argv[3], NULL, 10);
+      vector<unsigned int> colors;
+      if ( (fps < 1) || (fps > 1000) ) {
+         cout << "ERROR: FPS must be between 1 and 1000\n";
+         return 1;
+      }
+      for ( int i = 4; i < argc; i++ ) {
+         unsigned int red, green, blue;
+         if ( sscanf(argv[i], "%u,%u,%u", &red, &green, &blue) != 3 ) {
+            cout << "ERROR: colors are R,G,B, not '" << argv[i] << "'\n";
+            return 1;
+         }
+         colors.push_back(((red & 0xff) << 16) | ((green & 0xff) << 8) | (blue & 0xff));
+      }
+      paced = true;
+
+      // Frames are numbered from the message ID and stamped with the
+      // millisecond they are meant to be shown at
+      for ( unsigned int f = 0; f < frames; f++ ) {
+         unsigned char red, green, blue;
+         if ( !colors.empty() ) {
+            unsigned int color = colors[f % colors.size()];
+            red = color >> 16;
+            green = color >> 8;
+            blue = color;
+         } else {
+            // Once around the color wheel every two seconds
+            unsigned int hue = ((f * 1536) / (2 * fps)) % 1536;
+            unsigned int rise = hue % 256;
+            unsigned char sextant[6][3] = {
+               { 255, (unsigned char)rise, 0 }, { (unsigned char)(255 - rise), 255, 0 },
+               { 0, 255, (unsigned char)rise }, { 0, (unsigned char)(255 - rise), 255 },
+               { (unsigned char)rise, 0, 255 }, { 255, 0, (unsigned char)(255 - rise) } };
+            red = sextant[hue / 256][0];
+            green = sextant[hue / 256][1];
+            blue = sextant[hue / 256][2];
+         }
+         if ( (loss > 0) && ((unsigned int)(rand() % 100) < loss) ) continue;
+         packet.assign(PACKET_HEADER_SIZE, 0);
+         buildPacketHeader(&packet[0], messageID + f, CMD_STREAMFRAME, targets);
+         append32(packet, messageID + f);
+         append32(packet, messageID + (uint32_t)(((uint64_t)f * 1000) / fps));
+         packet.push_back(red);
+         packet.push_back(green);
+         packet.push_back(blue);
+         packets.push_back(packet);
+      }
+      // Lost frames are concealed by the receiver rather than resent
+      repeat = 1;
+   } else if ( (command == "effect") && (argc >= 4) ) {
+      unsigned int type = 0;
+      uint32_t seed = messageID;
+      vector<unsigned char> colors;
+      while ( (effectName(type) != NULL) && (argv[2] != string(effectName(type))) ) type++;
+      if ( effectName(type) == NULL ) {
+         cout << "ERROR: effects are breathe, rainbow, flicker and strobe, not '" << argv[2] << "'\n";
+         return 1;
+      }
+      int first = 4;
+      if ( (argc > 4) && (strchr(argv[4], ',') == NULL) ) {
+         seed = strtoul(argv[4], NULL, 10);
+         first = 5;
+      }
+      for ( int i = first; i < argc; i++ ) {
+         unsigned int red, green, blue;
+         if ( sscanf(argv[i], "%u,%u,%u", &red, &green, &blue) != 3 ) {
+            cout << "ERROR: colors are R,G,B, not '" << argv[i] << "'\n";
+            return 1;
+         }
+         colors.push_back((unsigned char)red);
+         colors.push_back((unsigned char)green);
+         colors.push_back((unsigned char)blue);
+      }
+      if ( colors.size() > EFFECT_MAX_COLORS * PACKET_EFFECT_COLOR_SIZE ) {
+         cout << "ERROR: an effect has at most " << EFFECT_MAX_COLORS << " colors\n";
+         return 1;
+      }
+      buildPacketHeader(&packet[0], messageID, CMD_EFFECT, targets);
+      packet.push_back((unsigned char)type);
+      append32(packet, strtoul(argv[3], NULL, 10));
+      append32(packet, seed);
+      packet.push_back((unsigned char)(colors.size() / PACKET_EFFECT_COLOR_SIZE));
+      packet.insert(packet.end(), colors.begin(), colors.end());
+   } else if ( command == "query" ) {
+      buildPacketHeader(&packet[0], messageID, CMD_QUERY, targets);
+   } else if ( command == "beacon" ) {
+      // Built as they are sent, since each carries the time it leaves
+      paced = true;
+   } else if ( (command == "settargets") && (argc >= 3) ) {
+      uint64_t membership;
+      if ( !parseTargetIDs(argv[2], membership, error) ) {
+         cout << "ERROR: " << error << "\n";
+         return 1;
+      }
+      buildPacketHeader(&packet[0], messageID, CMD_SETTARGETS, targets);
+      if ( membership == TARGETS_ALL ) membership = 0;
+      append32(packet, (uint32_t)membership);
+      append32(packet, (uint32_t)(membership >> 32));
+   } else {
+      usage();
+      return 1;
+   }
+
+   // Wrap the command in CMD_AT: the time to run it, then its own CMD byte
+   // and body
+   if ( at ) {
+      if ( (command == "beacon") || ((packet[12] != CMD_OFF) && (packet[12] != CMD_SETLEVELS) && (packet[12] != CMD_AUTOPATTERN) &&
+           (packet[12] != CMD_PLAYPATTERN) && (packet[12] != CMD_AUTODISABLE) && (packet[12] != CMD_EFFECT)) ) {
+         cout << "ERROR: --at only works with off, set, pattern, play, effect and autodisable\n";
+         return 1;
+      }
+      vector<unsigned char> wrapped(packet.begin(), packet.begin() + PACKET_HEADER_SIZE);
+      wrapped[12] = CMD_AT;
+      append64(wrapped, executeAt);
+      wrapped.push_back(packet[12]);
+      wrapped.insert(wrapped.end(), packet.begin() + PACKET_HEADER_SIZE, packet.end());
+      packet = wrapped;
+   }
+   if ( packets.empty() && (command != "beacon") ) packets.push_back(packet);
+
+   // Work out where it goes: the host given, or with multicast the group of
+   // every target (the all group when the message is for everyone)
+   vector<in_addr_t> destinations;
+   if ( multicast ) {
+      if ( targets == 0 ) destinations.push_back(multicastGroup(multicastBase, 0));
+      for ( unsigned int id = 1; id <= 64; id++ ) {
+         if ( targets & ((uint64_t)1 << (id - 1)) ) destinations.push_back(multicastGroup(multicastBase, id));
+      }
+   } else {
+      struct in_addr addr;
+      if ( inet_pton(AF_INET, host.c_str(), &addr) != 1 ) {
+         cout << "ERROR: " << host << " is not an IPv4 address\n";
+         return 1;
+      }
+      destinations.push_back(addr.s_addr);
+   }
+
+   int sock = socket(AF_INET, SOCK_DGRAM, 0);
+   int on = 1;
+   setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+   if ( multicastInterface != INADDR_ANY ) {
+      struct in_addr iface;
+      iface.s_addr = multicastInterface;
+      setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, &iface, sizeof(iface));
+   }
+
+   struct timespec start;
+   clock_gettime(CLOCK_MONOTONIC, &start);
+
+   // Beacons go out on a steady interval until count have been sent, or
+   // for ever
+   if ( command == "beacon" ) {
+      uint64_t interval = (argc >= 3) ? strtoull(argv[2], NULL, 10) * 1000 : 1000000;
+      unsigned long count = (argc >= 4) ? strtoul(argv[3], NULL, 10) : 0;
+      uint64_t due = ((uint64_t)start.tv_sec * 1000000) + (start.tv_nsec / 1000);
+      if ( interval < 1000 ) interval = 1000;
+      for ( unsigned long sent = 0; (count == 0) || (sent < count); sent++ ) {
+         struct timespec wake;
+         wake.tv_sec = due / 1000000;
+         wake.tv_nsec = (due % 1000000) * 1000;
+         clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+         packet.assign(PACKET_HEADER_SIZE, 0);
+         buildPacketHeader(&packet[0], messageID++, CMD_TIMESYNC, targets);
+         append64(packet, sharedNow());
+         for ( unsigned int d = 0; d < destinations.size(); d++ ) {
+            struct sockaddr_in to;
+            memset(&to, 0, sizeof(to));
+            to.sin_family = AF_INET;
+            to.sin_port = htons(port);
+            to.sin_addr.s_addr = destinations[d];
+            sendto(sock, &packet[0], packet.size(), 0, (struct sockaddr *)&to, sizeof(to));
+         }
+         due += interval;
+      }
+   }
+
+   for ( unsigned int r = 0; r < repeat; r++ ) {
+      for ( unsigned int p = 0; p < packets.size(); p++ ) {
+         // Stream frames go out on their timestamps
+         if ( paced ) {
+            uint32_t offset = packetLoad32(&packets[p][PACKET_HEADER_SIZE + 4]) - messageID;
+            uint64_t due = ((uint64_t)start.tv_sec * 1000000) + (start.tv_nsec / 1000) + ((uint64_t)offset * 1000);
+            struct timespec wake;
+            wake.tv_sec = due / 1000000;
+            wake.tv_nsec = (due % 1000000) * 1000;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+         }
+         for ( unsigned int d = 0; d < destinations.size(); d++ ) {
+            struct sockaddr_in to;
+            memset(&to, 0, sizeof(to));
+            to.sin_family = AF_INET;
+            to.sin_port = htons(port);
+            to.sin_addr.s_addr = destinations[d];
+            if ( sendto(sock, &packets[p][0], packets[p].size(), 0, (struct sockaddr *)&to, sizeof(to)) < 0 ) {
+               perror("sendto");
+               return 1;
+            }
+         }
+      }
+      // A little space between copies so one lost burst doesn't take them all
+      if ( r + 1 < repeat ) usleep(10000);
+   }
+
+   // Targets answer to the address we sent from
+   if ( command == "query" ) {
+      int wait = (argc >= 3) ? atoi(argv[2]) : 500;
+      struct timespec now;
+      uint64_t end = ((uint64_t)start.tv_sec * 1000) + (start.tv_nsec / 1000000) + wait;
+      while ( true ) {
+         clock_gettime(CLOCK_MONOTONIC, &now);
+         uint64_t ms = ((uint64_t)now.tv_sec * 1000) + (now.tv_nsec / 1000000);
+         if ( ms >= end ) break;
+
+         struct pollfd pfd;
+         pfd.fd = sock;
+         pfd.events = POLLIN;
+         if ( poll(&pfd, 1, (int)(end - ms)) <= 0 ) continue;
+
+         char reply[UDP_REPLY_SIZE + 1];
+         struct sockaddr_in from;
+         socklen_t fromLength = sizeof(from);
+         ssize_t length = recvfrom(sock, reply, UDP_REPLY_SIZE, 0, (struct sockaddr *)&from, &fromLength);
+         if ( length <= 0 ) continue;
+         while ( (length > 0) && (reply[length - 1] == '\n') ) length--;
+         reply[length] = 0;
+         char address[INET_ADDRSTRLEN];
+         inet_ntop(AF_INET, &from.sin_addr, address, sizeof(address));
+         cout << address << " " << reply << "\n";
+      }
+   }
+   close(sock);
+   return 0;
+}